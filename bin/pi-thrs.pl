@@ -67,7 +67,7 @@ BEGIN {
       $CFLAGS = substr($ARGV[0], 7), require File::Path;
       File::Path::rmtree("${base_dir}/.Inline");
    } else {
-      $CFLAGS = '-O2 -DBIG_SIEVE=0 -DUSE_GMP';
+      $CFLAGS = '-O2 -DUSE_GMP';
    }
 
    $MPLIB = ( index($CFLAGS,'-DUSE_GMP' ) >= 0 ||
@@ -662,6 +662,12 @@ __GMP_DECLSPEC extern const struct bases mp_bases[257];
   } while (0)
 
 
+#define mpn_invert __MPN(invert)
+__GMP_DECLSPEC void mpn_invert (mp_ptr, mp_srcptr, mp_size_t);
+
+#define mpn_inv_div_qr __MPN(inv_div_qr)
+__GMP_DECLSPEC mp_limb_t mpn_inv_div_qr (mp_ptr, mp_ptr, mp_size_t, mp_srcptr, mp_size_t, mp_srcptr);
+
 #ifndef mpn_preinv_divrem_1  /* if not done with cpuvec in a fat binary */
 #define mpn_preinv_divrem_1  __MPN(preinv_divrem_1)
 __GMP_DECLSPEC mp_limb_t mpn_preinv_divrem_1 (mp_ptr, mp_size_t, mp_srcptr, mp_size_t, mp_limb_t, mp_limb_t, int);
@@ -717,11 +723,26 @@ struct powers
   mp_size_t shift;		/* weight of lowest limb, in limb base B */
   size_t digits_in_base;	/* number of corresponding digits */
   int base;
+  mp_ptr ip;			/* inverse of p, or NULL */
+  mp_size_t in;			/* # of limbs at ip */
+  int norm;			/* p is shifted left by norm when ip is set */
 };
 typedef struct powers powers_t;
-#define mpn_dc_get_str_powtab_alloc(n) ((n) + 2 * GMP_LIMB_BITS)
+#define mpn_dc_get_str_powtab_alloc(n) ((n) + 2 * GMP_LIMB_BITS + 1)
 #define mpn_dc_get_str_itch(n) ((n) + GMP_LIMB_BITS)
 
+/* Scratch for converting n limbs from the given recursion level.  Each
+   parallel split, at levels up to GET_STR_PAR_LEVELS, hands both halves
+   their own area, after the quotient when it does not fit above the
+   remainder.  The quotient is at most about n/2 limbs, so each parallel
+   level adds n/2 limbs, and the slack doubles per level.  */
+#define GET_STR_PAR_LEVELS 3
+#define mpn_dc_get_str_par_k(level)					\
+  ((level) > GET_STR_PAR_LEVELS ? 0 : GET_STR_PAR_LEVELS + 1 - (level))
+#define mpn_dc_get_str_par_itch(n, level)				\
+  ((n) + mpn_dc_get_str_par_k (level) * ((n) / 2 + 1)			\
+   + (mp_size_t) GMP_LIMB_BITS * ((2 << mpn_dc_get_str_par_k (level)) - 1))
+
 /* Set n to the number of significant digits an mpf of the given _mp_prec
    field, in the given base.  This is a rounded up value, designed to ensure
    there's enough digits to reproduce all the guaranteed part of the value.
@@ -107,6 +107,152 @@ mpn_pow_1_highpart (mp_ptr rp, mp_size_t *ignp,
   return rn;
 }
 
+/* The scaling product of mpf_get_str needs only its limbs from off up.
+   Of the limb products u[i]*v[j], B^(i+j), B = 2^GMP_NUMB_BITS, those
+   on the diagonals i+j < c sum to less than c (B-1)(B^c - 1) < c B^(c+1).
+   A short product leaves them out, so it is short of the full product by
+   less than c B^(c+1) plus what it truncates.  */
+#ifndef GET_STR_MULHIGH_THRESHOLD
+#define GET_STR_MULHIGH_THRESHOLD 1000	/* limbs, tuning parameter */
+#endif
+#ifndef GET_STR_MULHIGH_BASECASE
+#define GET_STR_MULHIGH_BASECASE 32	/* limbs, tuning parameter */
+#endif
+#ifndef GET_STR_MULHIGH_ROWS
+#define GET_STR_MULHIGH_ROWS 16		/* limbs of u per basecase row */
+#endif
+
+/* Put the sum of u[i]*v[j] for i+j >= n - 1, and some below, divided by
+   B^(n-1) and truncated, at {rp + n - 1, n + 1}.  Each row of u is
+   multiplied by the part of v it needs, and lands at limb n - h.
+   {rp, n - 1} is clobbered, scratch tp of n limbs.  */
+static void
+mpn_mulhi_basecase (mp_ptr rp, mp_srcptr up, mp_srcptr vp, mp_size_t n,
+		    mp_ptr tp)
+{
+  mp_size_t i, h;
+
+  h = n < GET_STR_MULHIGH_ROWS ? n : GET_STR_MULHIGH_ROWS;
+  mpn_mul (rp + n - h, vp, n, up + n - h, h);
+
+  for (i = n - h; i > 0; i -= h)
+    {
+      h = i < GET_STR_MULHIGH_ROWS ? i : GET_STR_MULHIGH_ROWS;
+      mpn_mul (tp, vp + n - i, i, up + i - h, h);
+      mpn_add (rp + n - h, rp + n - h, n + h, tp, i + h);
+    }
+}
+
+/* Mulders' short product of {up, n} and {vp, n}: the sum of u[i]*v[j]
+   for i+j >= n - 1, and some below, divided by B^(n-1) and truncated,
+   at {rp + n - 1, n + 1}.  The top k x k product is full, the l x l
+   corners beside it are short.  The basecase is short by the diagonals
+   below n - 1 and the limbs it truncates, less than n B^n, and so is
+   the split, by 2l B^n.  {rp, n - 1} is clobbered, scratch tp of n
+   limbs.  */
+static void
+mpn_mulhi_n (mp_ptr rp, mp_srcptr up, mp_srcptr vp, mp_size_t n, mp_ptr tp)
+{
+  mp_size_t l, k;
+  mp_limb_t cy;
+
+  if (BELOW_THRESHOLD (n, GET_STR_MULHIGH_BASECASE))
+    {
+      mpn_mulhi_basecase (rp, up, vp, n, tp);
+      return;
+    }
+
+  l = 3 * n / 10;
+  k = n - l;
+
+  mpn_mul_n (rp + 2 * l, up + l, vp + l, k);
+
+  /* 2l <= n - 1, each corner is summed in {rp, 2l} below */
+  mpn_mulhi_n (rp, up + k, vp, l, tp);
+  cy = mpn_add_n (rp + n - 1, rp + n - 1, rp + l - 1, l + 1);
+  mpn_mulhi_n (rp, up, vp + k, l, tp);
+  cy += mpn_add_n (rp + n - 1, rp + n - 1, rp + l - 1, l + 1);
+  mpn_add_1 (rp + n + l, rp + n + l, k, cy);
+}
+
+#define mpn_mul_highpart_itch(un, vn) ((un) + 2 * (vn))
+
+/* Put the product of {up, un} and {vp, vn}, un >= vn, at {rp, un + vn},
+   of which the limbs from lo up are those of the full product, the ones
+   below are undefined.  With c = lo - 2, the limb products on diagonals
+   c and up are the top product {up + l, un - l} * {vp + l, vn - l}, the
+   strips below it, and two short l x l corners of Mulders whose sums are
+   truncated at B^c.  The result is short by less than c B^(c+1) for the
+   diagonals below c and l B^(c+1) for each corner, so by less than
+   2c B^(c+1), and no carry into limb lo is missing unless limb lo - 1
+   is within 2c of B, then the full product is taken.  The pieces cost more than the
+   full product, they are taken as OpenMP tasks when par is set and
+   there are threads for them.  Scratch tp of mpn_mul_highpart_itch.  */
+static void
+mpn_mul_highpart (mp_ptr rp, mp_srcptr up, mp_size_t un,
+		  mp_srcptr vp, mp_size_t vn, mp_size_t lo, mp_ptr tp, int par)
+{
+  mp_size_t c = lo - 2, l, n = un + vn, sn = un - c - 1;
+  mp_ptr bp, cp, sp;
+
+  ASSERT (un >= vn);
+
+  if (! par || c < GET_STR_MULHIGH_THRESHOLD || c >= vn)
+    {
+      mpn_mul (rp, up, un, vp, vn);
+      return;
+    }
+
+  l = 3 * c / 10;
+  bp = tp;			/* corners, 3l limbs each */
+  cp = tp + 3 * l;
+  sp = tp + 6 * l;		/* strips, un - c - 1 + l and vn - c - 1 + l */
+
+#if defined(_OPENMP)
+#pragma omp task
+#endif
+  mpn_mul (rp + 2 * l, up + l, un - l, vp + l, vn - l);
+#if defined(_OPENMP)
+#pragma omp task
+#endif
+  {
+    mpn_mulhi_n (bp, up + c - l + 1, vp, l, bp + 2 * l);
+    if (sn >= l)
+      mpn_mul (sp, up + c + 1, sn, vp, l);
+    else if (sn > 0)
+      mpn_mul (sp, vp, l, up + c + 1, sn);
+  }
+#if defined(_OPENMP)
+#pragma omp task
+#endif
+  {
+    mpn_mulhi_n (cp, up, vp + c - l + 1, l, cp + 2 * l);
+    if (vn - c - 1 >= l)
+      mpn_mul (sp + sn + l, vp + c + 1, vn - c - 1, up, l);
+    else if (vn - c - 1 > 0)
+      mpn_mul (sp + sn + l, up, l, vp + c + 1, vn - c - 1);
+  }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
+
+  if (sn > 0)
+    mpn_add (rp + c + 1, rp + c + 1, n - c - 1, sp, sn + l);
+  if (vn > c + 1)
+    mpn_add (rp + c + 1, rp + c + 1, n - c - 1, sp + sn + l, vn - c - 1 + l);
+  mpn_add (rp + c, rp + c, n - c, bp + l - 1, l + 1);
+  mpn_add (rp + c, rp + c, n - c, cp + l - 1, l + 1);
+
+  if (rp[lo - 1] > GMP_NUMB_MAX - (mp_limb_t) (2 * c))
+    mpn_mul (rp, up, un, vp, vn);
+}
+
+/* Limbs of digits by which the scale from the power table may exceed
+   the required one, above it mpf_get_str uses mpn_pow_1_highpart.  */
+#ifndef GET_STR_SCALE_SLACK
+#define GET_STR_SCALE_SLACK 8
+#endif
+
 char *
 mpf_get_str (char *dbuf, mp_exp_t *exp, int base, size_t n_digits, mpf_srcptr u)
 {
@@ -181,6 +327,12 @@ mpf_get_str (char *dbuf, mp_exp_t *exp, int base, size_t n_digits, mpf_srcptr u)
       /* We need to multiply number by base^n to get an n_digits integer part.  */
       mp_size_t n_more_limbs_needed, ign, off;
       mpir_ui e;
+      powers_t powtab[GMP_LIMB_BITS];
+      const powers_t *top = NULL;
+      mp_ptr powtab_mem, ip_mem, sp, hp = NULL;
+      mp_size_t sqn = 0;
+      mpir_ui e_req;
+      int n_pows, nthr = 1, par;
 
       n_more_limbs_needed = n_limbs_needed - ue;
       e = (mpir_ui) n_more_limbs_needed * (GMP_NUMB_BITS * mp_bases[base].chars_per_bit_exactly);
@@ -193,14 +345,88 @@ mpf_get_str (char *dbuf, mp_exp_t *exp, int base, size_t n_digits, mpf_srcptr u)
       pp = TMP_ALLOC_LIMBS (2 * n_limbs_needed + 2);
       tp = TMP_ALLOC_LIMBS (2 * n_limbs_needed + 2);
 
-      pn = mpn_pow_1_highpart (pp, &ign, (mp_limb_t) base, e, n_limbs_needed, tp);
-      if (un > pn)
-	mpn_mul (tp, up, un, pp, pn);	/* FIXME: mpn_mul_highpart */
+      n_pows = 0;
+      if (! POW2_P (base)
+	  && ! BELOW_THRESHOLD (n_limbs_needed, GET_STR_PRECOMPUTE_THRESHOLD))
+	{
+	  /* Build the conversion table now.  Its largest power squared is
+	     base^e for an e a few limbs above the one required, and serves
+	     as the scale in place of the squarings of mpn_pow_1_highpart.
+	     The table covers the scaled number but for those few limbs,
+	     which are split off before the conversion.  A large integer
+	     part leaves e far above the one required, then the table
+	     would not pay.  */
+	  powtab_mem = TMP_BALLOC_LIMBS (mpn_dc_get_str_powtab_alloc (n_limbs_needed));
+	  n_pows = mpn_get_str_powtab (powtab, powtab_mem, n_limbs_needed, base);
+	  top = &powtab[n_pows - 1];
+
+	  if ((mpir_ui) top->digits_in_base * 2 < e
+	      || (mpir_ui) top->digits_in_base * 2 - e
+		 > GET_STR_SCALE_SLACK * (mpir_ui) mp_bases[base].chars_per_limb)
+	    n_pows = 0;
+	}
+
+      sp = pp;
+      e_req = e;
+      if (n_pows != 0)
+	{
+	  e = (mpir_ui) top->digits_in_base * 2;
+	  tstr = (unsigned char *) TMP_ALLOC (n_digits + (e - e_req)
+					      + 2 * GMP_LIMB_BITS + 3);
+
+	  /* The power is normalized in place by mpn_get_str_preinv, so
+	     square it first.  The full square is kept at pp for the
+	     split, its high limbs at sp are the scale.  */
+	  mpn_sqr (pp, top->p, top->n);
+	  sqn = 2 * top->n;
+	  sqn -= pp[sqn - 1] == 0;
+	  pn = sqn;
+	  ign = 2 * top->shift;
+	  if (pn > n_limbs_needed)
+	    {
+	      ign += pn - n_limbs_needed;
+	      sp = pp + pn - n_limbs_needed;
+	      pn = n_limbs_needed;
+	    }
+	}
       else
-	mpn_mul (tp, pp, pn, up, un);	/* FIXME: mpn_mul_highpart */
+	pn = mpn_pow_1_highpart (pp, &ign, (mp_limb_t) base, e, n_limbs_needed, tp);
+
+      ip_mem = n_pows != 0 ? TMP_BALLOC_LIMBS
+	(mpn_get_str_preinv_itch (powtab, n_pows)) : NULL;
+
+      /* The inverses of the powers overlap the scaling product, which is
+	 taken in pieces on the other threads of up to four, if two.  The
+	 limbs below off are the fraction, the pieces leave most out.  */
+#if defined(_OPENMP)
+      if (get_str_par_levels > 0)
+	nthr = get_str_par_levels > 1 ? 4 : 2;
+#endif
+      par = nthr - (n_pows != 0) >= 2;
+      off = un - ue - ign;
+      if (par)
+	hp = TMP_BALLOC_LIMBS (un > pn ? mpn_mul_highpart_itch (un, pn)
+			       : mpn_mul_highpart_itch (pn, un));
+
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(nthr)
+#pragma omp single
+#endif
+      {
+	if (n_pows != 0)
+	  {
+#if defined(_OPENMP)
+#pragma omp task
+#endif
+	    mpn_get_str_preinv (powtab, n_pows, ip_mem);
+	  }
+	if (un > pn)
+	  mpn_mul_highpart (tp, up, un, sp, pn, off, hp, par);
+	else
+	  mpn_mul_highpart (tp, sp, pn, up, un, off, hp, par);
+      }
       tn = un + pn;
       tn -= tp[tn - 1] == 0;
-      off = un - ue - ign;
       if (off < 0)
 	{
 	  MPN_COPY_DECR (tp - off, tp, tn);
@@ -208,7 +434,32 @@ mpf_get_str (char *dbuf, mp_exp_t *exp, int base, size_t n_digits, mpf_srcptr u)
 	  tn -= off;
 	  off = 0;
 	}
-      n_digits_computed = mpn_get_str (tstr, base, tp + off, tn - off);
+      if (n_pows != 0)
+	{
+	  /* Divide off the few limbs at and above base^e, the remainder
+	     has e digits and is within the table.  */
+	  mp_ptr xp = tp + off, qp;
+	  mp_size_t xn = tn - off, sh = 2 * top->shift, qn = 0;
+	  size_t ql = 0;
+
+	  if (xn - sh >= sqn)
+	    {
+	      qn = xn - sh - sqn + 1;
+	      qp = TMP_ALLOC_LIMBS (qn);
+	      mpn_tdiv_qr (qp, xp + sh, (mp_size_t) 0, xp + sh, xn - sh, pp, sqn);
+	      xn = sh + sqn;
+	      while (qn > 0 && qp[qn - 1] == 0)
+		qn--;
+	      while (xn > 0 && xp[xn - 1] == 0)
+		xn--;
+	      if (qn != 0)
+		ql = mpn_get_str (tstr, base, qp, qn);
+	    }
+	  n_digits_computed = ql + mpn_get_str_convert
+	    (tstr + ql, ql != 0 ? e : 0, xp, xn, powtab, n_pows);
+	}
+      else
+	n_digits_computed = mpn_get_str (tstr, base, tp + off, tn - off);
 
       exp_in_base = n_digits_computed - e;
     }
@@ -26,6 +26,7 @@ You should have received a copy of the GNU Lesser General Public License
 along with the GNU MP Library.  If not, see http://www.gnu.org/licenses/.  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "mpir.h"
 #include "gmp-impl.h"
 #include "longlong.h"
@@ -268,6 +269,99 @@ mpn_sb_get_str (unsigned char *str, size_t len,
 }
 
 
+/* Parallel levels of the recursion, up to GET_STR_PAR_LEVELS, for at most
+   2^get_str_par_levels threads.  Set by the caller, 0 runs serially.  */
+size_t get_str_par_levels = GET_STR_PAR_LEVELS;
+
+/* Powers of at least GET_STR_PREINV_THRESHOLD limbs are also kept in
+   normalized form (idea 2 below), with their inverse.  The inverse is
+   computed once per level, instead of once per node by mpn_tdiv_qr, and
+   the nodes divide with mpn_inv_div_qr.  */
+#ifndef GET_STR_PREINV_THRESHOLD
+#define GET_STR_PREINV_THRESHOLD 500
+#endif
+
+#define mpn_dc_get_str_preinv_alloc(n) (n)
+
+/* Normalize the power at PW in place and compute its inverse at IP.  */
+static void
+mpn_dc_get_str_preinv (powers_t *pw, mp_ptr ip)
+{
+  mp_size_t n = pw->n;
+  mp_ptr dp = pw->p;
+  int cnt;
+
+  count_leading_zeros (cnt, dp[n - 1]);
+  if (cnt != 0)
+    mpn_lshift (dp, dp, n, cnt);
+
+  mpn_invert (ip, dp, n);
+
+  pw->ip = ip;
+  pw->in = n;
+  pw->norm = cnt;
+}
+
+/* Divide {np,nn} by the power at PW, using its cached inverse.  Write
+   nn - PW->n + 1 quotient limbs at qp and PW->n remainder limbs at rp.
+   The remainder may overlap the numerator.  */
+static void
+mpn_dc_get_str_divrem (mp_ptr qp, mp_ptr rp, mp_srcptr np, mp_size_t nn,
+		       const powers_t *pw)
+{
+  mp_size_t dn = pw->n;
+  mp_ptr tp;
+  int cnt = pw->norm;
+  TMP_DECL;
+
+  TMP_MARK;
+  tp = TMP_BALLOC_LIMBS (nn + 1);
+  if (cnt != 0)
+    tp[nn] = mpn_lshift (tp, np, nn, cnt);
+  else
+    {
+      MPN_COPY (tp, np, nn);
+      tp[nn] = 0;
+    }
+
+  /* the quotient fits nn - dn + 1 limbs, so the high limb is zero */
+  mpn_inv_div_qr (qp, tp, nn + 1, pw->p, dn, pw->ip);
+
+  if (cnt != 0)
+    mpn_rshift (rp, tp, dn, cnt);
+  else
+    MPN_COPY (rp, tp, dn);
+  TMP_FREE;
+}
+
+/* Compare {xp,n} with the power at PW, also of n limbs, which is held
+   shifted left by PW->norm when normalized.  */
+static int
+mpn_dc_get_str_cmp (mp_srcptr xp, mp_size_t n, const powers_t *pw)
+{
+  mp_srcptr pwp = pw->p;
+  int cnt = pw->norm;
+  mp_limb_t x;
+
+  if (pw->ip == NULL || cnt == 0)
+    return mpn_cmp (xp, pwp, n);
+
+  if (xp[n - 1] >> (GMP_LIMB_BITS - cnt) != 0)
+    return 1;
+
+  while (--n >= 0)
+    {
+      x = xp[n] << cnt;
+      if (n > 0)
+	x |= xp[n - 1] >> (GMP_LIMB_BITS - cnt);
+      if (x != pwp[n])
+	return x < pwp[n] ? -1 : 1;
+    }
+
+  return 0;
+}
+
+
 /* Convert {UP,UN} to a string with a base as represented in POWTAB, and put
    the string in STR.  Generate LEN characters, possibly padding with zeros to
    the left.  If LEN is zero, generate as many characters as required.
@@ -293,7 +387,7 @@ mpn_dc_get_str (unsigned char *str, size_t len,
     }
   else
     {
-      mp_ptr pwp, qp, rp;
+      mp_ptr pwp, qp, rp, tq;
       mp_size_t pwn, qn;
       mp_size_t sn;
 
@@ -301,7 +395,7 @@ mpn_dc_get_str (unsigned char *str, size_t len,
       pwn = powtab->n;
       sn = powtab->shift;
 
-      if (un < pwn + sn || (un == pwn + sn && mpn_cmp (up + sn, pwp, un - sn) < 0))
+      if (un < pwn + sn || (un == pwn + sn && mpn_dc_get_str_cmp (up + sn, un - sn, powtab) < 0))
         {
           str = mpn_dc_get_str (str, len, up, un, powtab - 1, tmp, level);
         }
@@ -310,25 +404,46 @@ mpn_dc_get_str (unsigned char *str, size_t len,
           qp = tmp;		/* (un - pwn + 1) limbs for qp */
           rp = up;		/* pwn limbs for rp; overwrite up area */
 
-          mpn_tdiv_qr (qp, rp + sn, 0L, up + sn, un - sn, pwp, pwn);
+          if (powtab->ip != NULL)
+            mpn_dc_get_str_divrem (qp, rp + sn, up + sn, un - sn, powtab);
+          else
+            mpn_tdiv_qr (qp, rp + sn, 0L, up + sn, un - sn, pwp, pwn);
           qn = un - sn - pwn; qn += qp[qn] != 0;		/* quotient size */
 
-          ASSERT (qn < pwn + sn || (qn == pwn + sn && mpn_cmp (qp + sn, pwp, pwn) < 0));
+          ASSERT (qn < pwn + sn || (qn == pwn + sn && mpn_dc_get_str_cmp (qp + sn, pwn, powtab) < 0));
+
+          /* Move the quotient above the remainder when it fits, leaving
+             all of tmp to the conversions below (idea 1).  */
+          if (qn <= un - sn - pwn)
+            {
+              MPN_COPY (up + sn + pwn, qp, qn);
+              qp = up + sn + pwn;
+              tq = tmp;
+            }
+          else
+            tq = tmp + qn;
 
           if (len != 0)
             len = len - powtab->digits_in_base;
 
-          if (level > 3 || powtab->digits_in_base < 500000UL)
+          if (level > get_str_par_levels || powtab->digits_in_base < 500000UL)
             {
-              str = mpn_dc_get_str (str, len, qp, qn, powtab - 1, tmp + qn, level);
+              str = mpn_dc_get_str (str, len, qp, qn, powtab - 1, tq, level);
               str = mpn_dc_get_str (str, powtab->digits_in_base, rp, pwn + sn, powtab - 1, tmp, level);
             }
           else
             {
-              mp_ptr tmp2 = (mp_limb_t *) malloc (sizeof(mp_limb_t) * mpn_dc_get_str_itch(un));
+              /* The halves convert side by side straight into str, with
+                 their own parts of tmp.  An open length gets an upper bound
+                 for the quotient, and its leading zeros are stripped after.  */
+              mp_ptr tmp2 = tq + mpn_dc_get_str_par_itch (qn, level + 1);
+              unsigned char *str2;
+              size_t qlen = len, z;
 
-              unsigned char *str2 = (unsigned char *) malloc(sizeof(char) * powtab->digits_in_base);
-              unsigned char *ptr2 = str2; size_t len2;
+              if (qlen == 0)
+                MPN_SIZEINBASE (qlen, qp, qn, powtab->base);
+
+              str2 = str + qlen;
 
               level += 1;
 
@@ -339,20 +454,25 @@ mpn_dc_get_str (unsigned char *str, size_t len,
                   int tid = omp_get_thread_num();
 
                   if (tid == 0)
-                    str = mpn_dc_get_str (str, len, qp, qn, powtab - 1, tmp + qn, level);
+                    mpn_dc_get_str (str, qlen, qp, qn, powtab - 1, tq, level);
 
                   if (tid == 1 || omp_get_num_threads() < 2)
-                    len2 = mpn_dc_get_str (str2, powtab->digits_in_base, rp, pwn + sn, powtab - 1, tmp2, level) - ptr2;
+                    mpn_dc_get_str (str2, powtab->digits_in_base, rp, pwn + sn, powtab - 1, tmp2, level);
 
              #if defined(_OPENMP)
                 }
              #endif
 
-              while (len2--)
-                *str++ = *ptr2++;
+              str2 += powtab->digits_in_base;
 
-              free(str2);
-              free(tmp2);
+              if (len == 0)
+                {
+                  for (z = 0; str[z] == 0; z++) ;
+                  memmove (str, str + z, str2 - str - z);
+                  str2 -= z;
+                }
+
+              str = str2;
             }
         }
     }
@@ -361,88 +481,20 @@ mpn_dc_get_str (unsigned char *str, size_t len,
 }
 
 
-/* There are no leading zeros on the digits generated at str, but that's not
-   currently a documented feature.  */
-
-size_t
-mpn_get_str (unsigned char *str, int base, mp_ptr up, mp_size_t un)
+/* Compute the powers of big_base for converting up to UN limbs, the largest
+   >= sqrt(U), into POWTAB, using POWTAB_MEM of mpn_dc_get_str_powtab_alloc
+   (UN) limbs.  Return the number of powers.  Their inverses are left to
+   mpn_get_str_preinv, so that mpf_get_str can square the largest for its
+   scaling first.  */
+static int
+mpn_get_str_powtab (powers_t *powtab, mp_ptr powtab_mem, mp_size_t un, int base)
 {
-  mp_ptr powtab_mem, powtab_mem_ptr;
+  mp_ptr powtab_mem_ptr = powtab_mem;
   mp_limb_t big_base;
   size_t digits_in_base;
-  powers_t powtab[GMP_LIMB_BITS];
   int pi;
   mp_size_t n;
   mp_ptr p, t;
-  size_t out_len;
-  mp_ptr tmp;
-  TMP_DECL;
-
-  /* Special case zero, as the code below doesn't handle it.  */
-  if (un == 0)
-    {
-      str[0] = 0;
-      return 1;
-    }
-
-  if (POW2_P (base))
-    {
-      /* The base is a power of 2.  Convert from most significant end.  */
-      mp_limb_t n1, n0;
-      int bits_per_digit = mp_bases[base].big_base;
-      int cnt;
-      int bit_pos;
-      mp_size_t i;
-      unsigned char *s = str;
-      mp_bitcnt_t bits;
-
-      n1 = up[un - 1];
-      count_leading_zeros (cnt, n1);
-
-      /* BIT_POS should be R when input ends in least significant nibble,
-	 R + bits_per_digit * n when input ends in nth least significant
-	 nibble. */
-
-      bits = (mp_bitcnt_t) GMP_NUMB_BITS * un - cnt + GMP_NAIL_BITS;
-      cnt = bits % bits_per_digit;
-      if (cnt != 0)
-	bits += bits_per_digit - cnt;
-      bit_pos = bits - (mp_bitcnt_t) (un - 1) * GMP_NUMB_BITS;
-
-      /* Fast loop for bit output.  */
-      i = un - 1;
-      for (;;)
-	{
-	  bit_pos -= bits_per_digit;
-	  while (bit_pos >= 0)
-	    {
-	      *s++ = (n1 >> bit_pos) & ((1 << bits_per_digit) - 1);
-	      bit_pos -= bits_per_digit;
-	    }
-	  i--;
-	  if (i < 0)
-	    break;
-	  n0 = (n1 << -bit_pos) & ((1 << bits_per_digit) - 1);
-	  n1 = up[i];
-	  bit_pos += GMP_NUMB_BITS;
-	  *s++ = n0 | (n1 >> bit_pos);
-	}
-
-      return s - str;
-    }
-
-  /* General case.  The base is not a power of 2.  */
-
-  if (BELOW_THRESHOLD (un, GET_STR_PRECOMPUTE_THRESHOLD))
-    return mpn_sb_get_str (str, (size_t) 0, up, un, base) - str;
-
-  TMP_MARK;
-
-  /* Allocate one large block for the powers of big_base.  */
-  powtab_mem = TMP_BALLOC_LIMBS (mpn_dc_get_str_powtab_alloc (un));
-  powtab_mem_ptr = powtab_mem;
-
-  /* Compute a table of powers, were the largest power is >= sqrt(U).  */
 
   big_base = mp_bases[base].big_base;
   digits_in_base = mp_bases[base].chars_per_limb;
@@ -451,9 +503,9 @@ mpn_get_str (unsigned char *str, int base, mp_ptr up, mp_size_t un)
     mp_size_t n_pows, xn, pn, exptab[GMP_LIMB_BITS], bexp;
     mp_limb_t cy;
     mp_size_t shift;
+    xn = 1 + un*(mp_bases[base].chars_per_bit_exactly*GMP_NUMB_BITS)/mp_bases[base].chars_per_limb;
 
     n_pows = 0;
-    xn = 1 + un*(mp_bases[base].chars_per_bit_exactly*GMP_NUMB_BITS)/mp_bases[base].chars_per_limb;
     for (pn = xn; pn != 1; pn = (pn + 1) >> 1)
       {
 	exptab[n_pows] = pn;
@@ -461,7 +513,9 @@ mpn_get_str (unsigned char *str, int base, mp_ptr up, mp_size_t un)
       }
     exptab[n_pows] = 1;
 
-    powtab[0].p = &big_base;
+    /* big_base lives in the block too, the table outlives this call */
+    powtab[0].p = powtab_mem_ptr;  powtab_mem_ptr += 1;
+    powtab[0].p[0] = big_base;
     powtab[0].n = 1;
     powtab[0].digits_in_base = digits_in_base;
     powtab[0].base = base;
@@ -532,6 +586,9 @@ mpn_get_str (unsigned char *str, int base, mp_ptr up, mp_size_t un)
 	powtab[pi].digits_in_base += mp_bases[base].chars_per_limb;
       }
 
+    for (pi = 0; pi < n_pows; pi++)
+      powtab[pi].ip = NULL;
+
 #if 0
     { int i;
       printf ("Computed table values for base=%d, un=%d, xn=%d:\n", base, un, xn);
@@ -539,7 +596,51 @@ mpn_get_str (unsigned char *str, int base, mp_ptr up, mp_size_t un)
 	printf ("%2d: %10ld %10ld %11ld %ld\n", i, exptab[n_pows-i], powtab[i].n, powtab[i].digits_in_base, powtab[i].shift);
     }
 #endif
+
+    return n_pows;
   }
+}
+
+/* Limbs for the inverses of the N_POWS powers in POWTAB.  */
+static mp_size_t
+mpn_get_str_preinv_itch (const powers_t *powtab, int n_pows)
+{
+  mp_size_t n = 1;
+  int pi;
+
+  for (pi = 0; pi < n_pows; pi++)
+    if (powtab[pi].n >= GET_STR_PREINV_THRESHOLD)
+      n += mpn_dc_get_str_preinv_alloc (powtab[pi].n);
+
+  return n;
+}
+
+/* Normalize the powers in POWTAB of at least GET_STR_PREINV_THRESHOLD limbs
+   and compute their inverses, using IP_MEM of mpn_get_str_preinv_itch
+   limbs.  */
+static void
+mpn_get_str_preinv (powers_t *powtab, int n_pows, mp_ptr ip_mem)
+{
+  int pi;
+
+  for (pi = 0; pi < n_pows; pi++)
+    if (powtab[pi].n >= GET_STR_PREINV_THRESHOLD)
+      {
+	mpn_dc_get_str_preinv (&powtab[pi], ip_mem);
+	ip_mem += mpn_dc_get_str_preinv_alloc (powtab[pi].n);
+      }
+}
+
+/* Convert {UP,UN} using the N_POWS powers in POWTAB, generating LEN digits,
+   or as many as required if LEN is zero.  {UP,UN} must be below the square
+   of the largest power.  */
+static size_t
+mpn_get_str_convert (unsigned char *str, size_t len, mp_ptr up, mp_size_t un,
+		     const powers_t *powtab, int n_pows)
+{
+  size_t out_len;
+  mp_ptr tmp;
+  TMP_DECL;
 
   int t_dynamic, t_nested, t_levels;
 
@@ -553,9 +654,9 @@ mpn_get_str (unsigned char *str, int base, mp_ptr up, mp_size_t un)
   omp_set_max_active_levels(3);
 #endif
 
-  /* Using our precomputed powers, now in powtab[], convert our number.  */
-  tmp = TMP_BALLOC_LIMBS (mpn_dc_get_str_itch (un));
-  out_len = mpn_dc_get_str (str, 0, up, un, powtab - 1 + pi, tmp, 1) - str;
+  TMP_MARK;
+  tmp = TMP_BALLOC_LIMBS (mpn_dc_get_str_par_itch (un, 1));
+  out_len = mpn_dc_get_str (str, len, up, un, powtab + (n_pows - 1), tmp, 1) - str;
   TMP_FREE;
 
 #if defined(_OPENMP)
@@ -566,3 +667,90 @@ mpn_get_str (unsigned char *str, int base, mp_ptr up, mp_size_t un)
 
   return out_len;
 }
+
+/* There are no leading zeros on the digits generated at str, but that's not
+   currently a documented feature.  */
+
+size_t
+mpn_get_str (unsigned char *str, int base, mp_ptr up, mp_size_t un)
+{
+  mp_ptr powtab_mem;
+  powers_t powtab[GMP_LIMB_BITS];
+  int n_pows;
+  size_t out_len;
+  TMP_DECL;
+
+  /* Special case zero, as the code below doesn't handle it.  */
+  if (un == 0)
+    {
+      str[0] = 0;
+      return 1;
+    }
+
+  if (POW2_P (base))
+    {
+      /* The base is a power of 2.  Convert from most significant end.  */
+      mp_limb_t n1, n0;
+      int bits_per_digit = mp_bases[base].big_base;
+      int cnt;
+      int bit_pos;
+      mp_size_t i;
+      unsigned char *s = str;
+      mp_bitcnt_t bits;
+
+      n1 = up[un - 1];
+      count_leading_zeros (cnt, n1);
+
+      /* BIT_POS should be R when input ends in least significant nibble,
+	 R + bits_per_digit * n when input ends in nth least significant
+	 nibble. */
+
+      bits = (mp_bitcnt_t) GMP_NUMB_BITS * un - cnt + GMP_NAIL_BITS;
+      cnt = bits % bits_per_digit;
+      if (cnt != 0)
+	bits += bits_per_digit - cnt;
+      bit_pos = bits - (mp_bitcnt_t) (un - 1) * GMP_NUMB_BITS;
+
+      /* Fast loop for bit output.  */
+      i = un - 1;
+      for (;;)
+	{
+	  bit_pos -= bits_per_digit;
+	  while (bit_pos >= 0)
+	    {
+	      *s++ = (n1 >> bit_pos) & ((1 << bits_per_digit) - 1);
+	      bit_pos -= bits_per_digit;
+	    }
+	  i--;
+	  if (i < 0)
+	    break;
+	  n0 = (n1 << -bit_pos) & ((1 << bits_per_digit) - 1);
+	  n1 = up[i];
+	  bit_pos += GMP_NUMB_BITS;
+	  *s++ = n0 | (n1 >> bit_pos);
+	}
+
+      return s - str;
+    }
+
+  /* General case.  The base is not a power of 2.  */
+
+  if (BELOW_THRESHOLD (un, GET_STR_PRECOMPUTE_THRESHOLD))
+    return mpn_sb_get_str (str, (size_t) 0, up, un, base) - str;
+
+  TMP_MARK;
+
+  /* Allocate one large block for the powers of big_base.  */
+  powtab_mem = TMP_BALLOC_LIMBS (mpn_dc_get_str_powtab_alloc (un));
+
+  /* Compute a table of powers, were the largest power is >= sqrt(U).  */
+  n_pows = mpn_get_str_powtab (powtab, powtab_mem, un, base);
+  mpn_get_str_preinv (powtab, n_pows, TMP_BALLOC_LIMBS
+		      (mpn_get_str_preinv_itch (powtab, n_pows)));
+
+  /* Using our precomputed powers, now in powtab[], convert our number.  */
+  out_len = mpn_get_str_convert (str, 0, up, un, powtab, n_pows);
+  TMP_FREE;
+
+  return out_len;
+}
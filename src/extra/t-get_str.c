@@ -0,0 +1,274 @@
+/* Randomized round trip of mpz_get_str and mpf_get_str through the
+   replacement mpn_get_str and mpf_get_str in this directory.
+
+   Build and run from ../ with "make check", or by hand, e.g.
+     gcc -O2 -fopenmp -DUSE_GMP extra/t-get_str.c -o t-get_str -lgmp
+
+   Integers come back exactly through mpz_set_str. Floats are checked
+   against the exact value: their digits must be within one unit in the
+   last place, and those of an integer-valued float must be the digits of
+   the integer. The sizes reach the threshold of the divide-and-conquer
+   conversion and the shared power table of mpf_get_str, with and without
+   an integer part of about the size of the value. A few values of 1.2M
+   digits and more, and powers of ten, reach the parallel split of
+   mpn_get_str at one and two levels.
+
+   The short products of mpf_get_str are checked against mpn_mul: the
+   limbs of mpn_mul_highpart from lo up must be exact, and mpn_mulhi_n
+   short by less than n B^n. Its threshold is lowered to reach them
+   with the small sizes too.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#define GET_STR_MULHIGH_THRESHOLD 40
+
+#if defined(USE_GMP) || !defined(USE_MPIR)
+ #include <gmp.h>
+ #if defined(_OPENMP)
+  #include "gmp/mpn_get_str_omp.c"
+ #else
+  #include "gmp/mpn_get_str_thr.c"
+ #endif
+ #include "gmp/mpf_get_str.c"
+#else
+ #include <mpir.h>
+ #if defined(_OPENMP)
+  #include "mpir/mpn_get_str_omp.c"
+ #else
+  #include "mpir/mpn_get_str_thr.c"
+ #endif
+ #include "mpir/mpf_get_str.c"
+#endif
+
+#define REPS      300
+#define MAX_LIMBS 6000
+#define BIG_REPS  6
+#define BIG_BITS  4200000UL             /* about 1.26M digits */
+
+static int fails = 0;
+
+static void fail (const char *what, unsigned long bits, long digits, int i)
+{
+  fprintf(stderr, "t-get_str: %s, %lu bits, %ld digits, test %d\n",
+    what, bits, digits, i);
+  fails++;
+}
+
+static void check_z (gmp_randstate_t rs, unsigned long bits, int i)
+{
+  mpz_t x, y;
+  char *s;
+
+  mpz_init(x), mpz_init(y);
+  mpz_rrandomb(x, rs, bits);
+  if (i & 1) mpz_neg(x, x);
+
+  s = mpz_get_str(NULL, 10, x);
+  mpz_set_str(y, s, 10);
+
+  if (mpz_cmp(x, y) != 0)
+    fail("mpz round trip", bits, (long) strlen(s), i);
+
+  free(s);
+  mpz_clear(x), mpz_clear(y);
+}
+
+/* x = z / 2^shift at prec bits, with a digits string of n_digits */
+static void check_f (gmp_randstate_t rs, unsigned long bits, int i)
+{
+  unsigned long shift, prec;
+  size_t n_digits, len;
+  mp_exp_t exp;
+  mpf_t x, y, d, ulp;
+  mpz_t z;
+  char *s, *t;
+
+  /* an integer part of any size from none to all of the value */
+  switch (i % 3) {
+    case 0:  shift = 0; break;
+    case 1:  shift = bits - gmp_urandomm_ui(rs, 64); break;
+    default: shift = gmp_urandomm_ui(rs, bits);
+  }
+
+  prec = bits + gmp_urandomm_ui(rs, 2 * GMP_NUMB_BITS);
+  n_digits = (i % 5 == 0) ? 0 : 1 + gmp_urandomm_ui(rs, prec * 0.30103 + 40);
+
+  mpz_init(z);
+  mpz_urandomb(z, rs, bits);
+  mpz_setbit(z, bits - 1);
+
+  mpf_init2(x, prec);
+  mpf_set_z(x, z);
+  mpf_div_2exp(x, x, shift);
+
+  s = mpf_get_str(NULL, &exp, 10, n_digits, x);
+  len = strlen(s);
+
+  if (len == 0 || (n_digits != 0 && len > n_digits) || s[len-1] == '0') {
+    fail("mpf digits", bits, (long) n_digits, i);
+    goto done;
+  }
+
+  /* |x - 0.s * 10^exp| <= 10^(exp - len) */
+  mpf_init2(y, bits + 4 * (len + 64));
+  mpf_init2(d, bits + 4 * (len + 64));
+  mpf_init2(ulp, 64);
+
+  t = malloc(len + 32);
+  sprintf(t, "0.%se%ld", s, (long) exp);
+  mpf_set_str(y, t, 10);
+  free(t);
+
+  mpf_sub(d, y, x);
+  mpf_abs(d, d);
+  mpf_set_ui(ulp, 10);
+  if (exp >= (mp_exp_t) len)
+    mpf_pow_ui(ulp, ulp, exp - len);
+  else
+    mpf_pow_ui(ulp, ulp, len - exp), mpf_ui_div(ulp, 1, ulp);
+
+  if (mpf_cmp(d, ulp) > 0)
+    fail("mpf value", bits, (long) n_digits, i);
+
+  /* an integer with all its digits converts exactly */
+  if (shift == 0 && n_digits == 0) {
+    t = mpz_get_str(NULL, 10, z);
+    if ((size_t) exp != strlen(t) || strncmp(s, t, len) != 0 ||
+        strspn(t + len, "0") != strlen(t + len))
+      fail("mpf integer", bits, (long) n_digits, i);
+    free(t);
+  }
+
+  mpf_clear(y), mpf_clear(d), mpf_clear(ulp);
+
+done:
+  free(s);
+  mpf_clear(x), mpz_clear(z);
+}
+
+/* {rp, n} from an mpz of random bits, or of long runs of ones and zeros,
+   which bring limb lo - 1 close to B and the full product */
+static void random_limbs (gmp_randstate_t rs, mp_ptr rp, mp_size_t n, int i)
+{
+  mpz_t z;
+
+  mpz_init(z);
+  if (i & 1)
+    mpz_rrandomb(z, rs, n * GMP_NUMB_BITS);
+  else
+    mpz_urandomb(z, rs, n * GMP_NUMB_BITS);
+  mpz_setbit(z, n * GMP_NUMB_BITS - 1);
+  mpz_export(rp, NULL, -1, sizeof(mp_limb_t), 0, GMP_NAIL_BITS, z);
+  mpz_clear(z);
+}
+
+static void check_mulhigh (gmp_randstate_t rs, int i)
+{
+  mp_size_t vn = 1 + gmp_urandomm_ui(rs, 1500);
+  mp_size_t un = vn + gmp_urandomm_ui(rs, vn + 1);
+  mp_size_t lo = gmp_urandomm_ui(rs, vn + 2), n = vn, j;
+  mp_ptr up, vp, rp, fp, tp;
+
+  up = malloc(sizeof(mp_limb_t) * un);
+  vp = malloc(sizeof(mp_limb_t) * vn);
+  rp = malloc(sizeof(mp_limb_t) * (un + vn));
+  fp = malloc(sizeof(mp_limb_t) * (un + vn));
+  tp = malloc(sizeof(mp_limb_t) * mpn_mul_highpart_itch(un, vn));
+
+  random_limbs(rs, up, un, i);
+  random_limbs(rs, vp, vn, i);
+  mpn_mul(fp, up, un, vp, vn);
+
+  /* in a team, the pieces run as tasks */
+ #if defined(_OPENMP)
+  #pragma omp parallel num_threads(4)
+  #pragma omp single
+ #endif
+  mpn_mul_highpart(rp, up, un, vp, vn, lo, tp, 1);
+
+  if (mpn_cmp(rp + lo, fp + lo, un + vn - lo) != 0)
+    fail("mpn_mul_highpart", (unsigned long) un, (long) lo, i);
+
+  /* fp - {rp + n - 1, n + 1} B^(n-1) in [0, n B^n) */
+  mpn_mul_n(fp, up, vp, n);
+  mpn_mulhi_n(rp, up, vp, n, tp);
+  for (j = 0; j < n - 1; j++)
+    rp[j] = 0;
+  if (mpn_sub_n(rp, fp, rp, 2 * n) != 0 || rp[n] >= (mp_limb_t) n ||
+      (n > 1 && mpn_zero_p(rp + n + 1, n - 1) == 0))
+    fail("mpn_mulhi_n", (unsigned long) n, (long) n, i);
+
+  free(up), free(vp), free(rp), free(fp), free(tp);
+}
+
+/* 10^n and 10^n - 1, whose quotients by the powers are all zeros or nines */
+static void check_pow10 (unsigned long n)
+{
+  mpz_t x;
+  char *s;
+  size_t len;
+
+  mpz_init(x);
+  mpz_ui_pow_ui(x, 10, n);
+
+  s = mpz_get_str(NULL, 10, x);
+  len = strlen(s);
+  if (len != n + 1 || s[0] != '1' || strspn(s + 1, "0") != n)
+    fail("10^n", 0, (long) n, -1);
+  free(s);
+
+  mpz_sub_ui(x, x, 1);
+  s = mpz_get_str(NULL, 10, x);
+  len = strlen(s);
+  if (len != n || strspn(s, "9") != n)
+    fail("10^n - 1", 0, (long) n, -1);
+  free(s);
+
+  mpz_clear(x);
+}
+
+int main (int argc, char *argv[])
+{
+  gmp_randstate_t rs;
+  unsigned long seed = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1;
+  size_t levels = get_str_par_levels;
+  int i;
+
+  gmp_randinit_default(rs);
+  gmp_randseed_ui(rs, seed);
+
+  for (i = 0; i < REPS; i++) {
+    check_z(rs, 1 + gmp_urandomm_ui(rs, MAX_LIMBS * GMP_NUMB_BITS), i);
+    check_f(rs, 64 + gmp_urandomm_ui(rs, MAX_LIMBS * GMP_NUMB_BITS), i);
+    check_mulhigh(rs, i);
+  }
+
+  /* the parallel split, from 500000 digits in the top power */
+  for (i = 0; i < BIG_REPS; i++) {
+    get_str_par_levels = 1 + i % 2;
+    check_z(rs, BIG_BITS + gmp_urandomm_ui(rs, BIG_BITS), i);
+    check_f(rs, BIG_BITS + gmp_urandomm_ui(rs, BIG_BITS), i);
+  }
+
+  get_str_par_levels = 2;
+  check_pow10(1500000);
+  check_pow10(2500000);
+
+  get_str_par_levels = levels;
+  gmp_randclear(rs);
+
+  if (fails) {
+    fprintf(stderr, "t-get_str: %d of %d failed, seed %lu\n",
+      fails, 3 * REPS + 2 * (BIG_REPS + 2), seed);
+    return 1;
+  }
+
+  printf("t-get_str: %d passed, seed %lu\n", 3 * REPS + 2 * (BIG_REPS + 2), seed);
+  return 0;
+}
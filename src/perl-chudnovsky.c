@@ -67,7 +67,7 @@ void *_mul (void *thr_arg)
   return ((void *) 0);
 }
 
-uint_t chudnovsky_init (SV *digits_sv)
+uint64_t chudnovsky_init (SV *digits_sv)
 {
   uint64_t digits;
 
@@ -82,7 +82,8 @@ uint_t chudnovsky_init (SV *digits_sv)
    */
   PL_signals |= PERL_SIGNALS_UNSAFE_FLAG;
 
-  uint_t terms = digits / DIGITS_PER_ITER;
+  uint64_t terms = digits / DIGITS_PER_ITER;
+  uint_select(terms);
   mpf_set_default_prec((long)(digits * BITS_PER_DIGIT + 16));
 
   mpz_init(p0); mpz_init(q0); mpz_init(g0);
@@ -92,61 +93,37 @@ uint_t chudnovsky_init (SV *digits_sv)
 
 uint64_t chudnovsky_max_digits ()
 {
-  return MAX_DIGITS;
+  /* the perl drivers combine partitions with mpz_t only */
+  return min(MAX_DIGITS, BIGZ_DIGITS);
 }
 
-void chudnovsky_build_sieve (uint_t terms)
+void chudnovsky_build_sieve (uint64_t terms)
 {
   char *args[] = { NULL };
   call_argv("sieve_begin_time", G_DISCARD|G_VOID, args);
 
-  sieve_size = max(3*5*23*29+1, terms*6);
-  sieve = (sieve_t *) malloc(sizeof(sieve_t)*sieve_size/2);
-  build_sieve(sieve_size, sieve);
+  sieve_init(terms);
+  sieve_fill();
 
   call_argv("sieve_end_time", G_DISCARD|G_VOID, args);
 }
 
 void chudnovsky_free_sieve ()
 {
-  free(sieve);
+  sieve_free();
 }
 
-void chudnovsky_bs (uint_t a, uint_t b, uint_t terms, uint_t level, int fd_i, uint_t depth)
+void chudnovsky_bs (uint64_t a, uint64_t b, uint64_t terms, uint64_t level, int fd_i, uint64_t depth)
 {
-  fac_t fp1, fg1, ftmp, fmul;
-  mpz_t gcd, p1, q1, g1;
-  uint_t j;
-
-  fac_init(fp1), fac_init(ftmp), mpz_init(gcd);
-  fac_init(fg1), fac_init(fmul);
-
-  tmp_t *tmp = (tmp_t *) malloc(sizeof(tmp_t) * (depth - 1));
-
-  for (j = 0; j < depth - 1; j++) {
-    mpz_init(tmp[j].p),  mpz_init(tmp[j].q),  mpz_init(tmp[j].g);
-    fac_init(tmp[j].fp), fac_init(tmp[j].fg), tmp[j].cleared = 0;
-  }
+  mpz_t p1, q1, g1;
 
   if (a == 0) {
-    bs(p0, q0, g0, fp1, fg1, a, b, terms, level, gcd, ftmp, fmul, tmp, 0, 1);
+    bs_range(p0, q0, g0, a, b, terms, level, depth, NULL);
   } else {
     mpz_init(p1), mpz_init(q1), mpz_init(g1);
-    bs(p1, q1, g1, fp1, fg1, a, b, terms, level, gcd, ftmp, fmul, tmp, 0, 1);
-  }
-
-  for (j = 0; j < depth - 1; j++) {
-    if (!tmp[j].cleared) {
-      mpz_clear(tmp[j].p),  mpz_clear(tmp[j].q),  mpz_clear(tmp[j].g);
-      fac_clear(tmp[j].fp), fac_clear(tmp[j].fg);
-    }
+    bs_range(p1, q1, g1, a, b, terms, level, depth, NULL);
   }
 
-  free(tmp);
-
-  fac_clear(fp1), fac_clear(ftmp), mpz_clear(gcd);
-  fac_clear(fg1), fac_clear(fmul);
-
   if (a > 0) {
     FILE *file_i = fdopen(fd_i, "wb");
 
@@ -163,7 +140,7 @@ void chudnovsky_bs (uint_t a, uint_t b, uint_t terms, uint_t level, int fd_i, ui
   }
 }
 
-double chudnovsky_sum (uint_t i, uint_t k, int fd_i, int fd_k, char *path_k, int gflag)
+double chudnovsky_sum (uint64_t i, uint64_t k, int fd_i, int fd_k, char *path_k, int gflag)
 {
   double join_begin, pthread_time = 0.0;
   mpz_t p1, q1, g1, p2, q2, g2;
@@ -283,7 +260,7 @@ void chudnovsky_sqrt (int fd_c)
   fclose(file_c);
 }
 
-void chudnovsky_final (uint64_t digits, int out, uint_t terms, char *path_c)
+void chudnovsky_final (uint64_t digits, int out, uint64_t terms, char *path_c)
 {
   mpf_t pi, qi, ci;
   uint64_t psize, qsize;
@@ -352,20 +329,17 @@ void chudnovsky_final (uint64_t digits, int out, uint_t terms, char *path_c)
   /* output Pi */
 
   if (out == 1) {
-    mp_exp_t exp = 0; int i;
-    char *str = malloc(digits+16+2);
+    char *str = mpf_get_digits(qi, digits);
 
-    mpf_get_str(&(str[1]), &exp, 10, digits+16, qi);
-    for (i = 0; i < exp; i++) str[i] = str[i+1];
-
-    str[exp] = '.', str[digits+2] = 0;
-    fwrite(str, sizeof(char), digits+2, stdout), fflush(stdout);
+    fwrite(str, sizeof(char), strlen(str), stdout), fflush(stdout);
     fprintf(stderr, "\n"), fflush(stderr);
 
     free((void *) str);
   }
   else if (out >= 2 && out <= 14) {
-    output_digits(qi, digits, out);
+    char *str = mpf_get_digits(qi, digits);
+    output_digits(str, digits, out);
+    free((void *) str);
   }
 
   mpf_clear(qi);
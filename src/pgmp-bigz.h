@@ -0,0 +1,373 @@
+#line 2 "../src/pgmp-bigz.h"
+/* Large integers beyond the mpz_t size limit for pgmp-chudnovsky.c.
+
+ * See pgmp-chudnovsky.h for the list of authors and the license.
+
+ * The _mp_size and _mp_alloc fields of mpz_t and mpf_t are int, capping
+ * an mpz_t at INT_MAX limbs (roughly 41 billion digits). The mpn layer
+ * takes mp_size_t (long) sizes, so bigz_t keeps a plain limb buffer with
+ * 64-bit size fields and calls mpn functions directly. It serves the top
+ * levels of the sum tree and the final stage for record-scale runs. The
+ * per-thread bs() partitions remain mpz_t.
+ *
+ * The final stage runs in binary fixed point, with n limbs after the
+ * radix point, where the mpf_t code cannot follow:
+ *
+ *   bigz_fix_div      t = num/den * 2^(64(n+1))
+ *   bigz_fix_sqrt_ui  s = sqrt(x) * 2^(64n)
+ *   bigz_fix_mul      r = t*s / 2^(64(n+1))
+ *   bigz_fix_get_str  decimal digits of r
+ *
+ * A limb is assumed to be 64 bits where the comments say 64.
+ */
+
+#ifndef PGMP_BIGZ_H
+#define PGMP_BIGZ_H
+
+#include "pgmp-chudnovsky.h"
+
+typedef struct {
+  mp_ptr    d;
+  mp_size_t alloc;
+  mp_size_t size;         /* negative for negative numbers, like mpz_t */
+} bigz_struct;
+
+typedef bigz_struct bigz_t[1];
+
+#define BIGZ_ABS(x)  ((x) >= 0 ? (x) : -(x))
+#define BIGZ_BYTES(n) ((size_t) (n) * sizeof(mp_limb_t))
+
+// Use the GMP/MPIR memory functions, allowing limbs to move between
+// mpz_t and bigz_t without copying.
+
+mp_ptr bigz_alloc_limbs (mp_size_t n)
+{
+  void *(*alloc_func) (size_t);
+  mp_get_memory_functions(&alloc_func, NULL, NULL);
+  return (mp_ptr) alloc_func(BIGZ_BYTES(max(n, 1)));
+}
+
+void bigz_free_limbs (mp_ptr p, mp_size_t n)
+{
+  void (*free_func) (void *, size_t);
+  mp_get_memory_functions(NULL, NULL, &free_func);
+  free_func(p, BIGZ_BYTES(max(n, 1)));
+}
+
+void bigz_init (bigz_t x)
+{
+  x->d = bigz_alloc_limbs(1);
+  x->alloc = 1;
+  x->size = 0;
+}
+
+void bigz_clear (bigz_t x)
+{
+  bigz_free_limbs(x->d, x->alloc);
+}
+
+/* replace the limbs of x, freeing the old ones */
+void bigz_set_limbs (bigz_t x, mp_ptr d, mp_size_t alloc, mp_size_t size)
+{
+  bigz_free_limbs(x->d, x->alloc);
+  x->d = d, x->alloc = alloc, x->size = size;
+}
+
+/* x = z, taking ownership of the limbs of z; z is left as zero */
+void bigz_set_mpz (bigz_t x, mpz_t z)
+{
+  bigz_set_limbs(x, z->_mp_d, z->_mp_alloc, z->_mp_size);
+  mpz_init(z);
+}
+
+uint64_t bigz_sizeinbase10 (bigz_t x)
+{
+  mp_size_t n = BIGZ_ABS(x->size);
+  uint64_t bits;
+  int i;
+
+  if (n == 0)
+    return 1;
+
+  for (i = 0; i < GMP_NUMB_BITS && (x->d[n-1] >> i) > 1; i++) ;
+  bits = (uint64_t) (n-1) * GMP_NUMB_BITS + i + 1;
+
+  return (uint64_t) (bits / BITS_PER_DIGIT) + 1;
+}
+
+/* r = a*b */
+void bigz_mul (bigz_t r, bigz_t a, bigz_t b)
+{
+  mp_size_t an = BIGZ_ABS(a->size), bn = BIGZ_ABS(b->size), rn;
+  mp_ptr rp;
+
+  if (an == 0 || bn == 0) {
+    r->size = 0;
+    return;
+  }
+
+  rn = an + bn;
+  rp = bigz_alloc_limbs(rn);
+
+  if (a == b)
+    mpn_sqr(rp, a->d, an);
+  else if (an >= bn)
+    mpn_mul(rp, a->d, an, b->d, bn);
+  else
+    mpn_mul(rp, b->d, bn, a->d, an);
+
+  rn -= (rp[rn-1] == 0);
+  bigz_set_limbs(r, rp, an + bn, ((a->size < 0) != (b->size < 0)) ? -rn : rn);
+}
+
+/* r = a*x */
+void bigz_mul_ui (bigz_t r, bigz_t a, mp_limb_t x)
+{
+  mp_size_t an = BIGZ_ABS(a->size);
+  mp_ptr rp = bigz_alloc_limbs(an + 1);
+
+  rp[an] = mpn_mul_1(rp, a->d, an, x);
+  an += (rp[an] != 0);
+  bigz_set_limbs(r, rp, BIGZ_ABS(a->size) + 1, (a->size < 0) ? -an : an);
+
+  if (x == 0) r->size = 0;
+}
+
+/* r = a+b */
+void bigz_add (bigz_t r, bigz_t a, bigz_t b)
+{
+  mp_size_t an = BIGZ_ABS(a->size), bn = BIGZ_ABS(b->size), rn;
+  int asign = (a->size < 0), bsign = (b->size < 0);
+  mp_ptr rp;
+
+  if (an < bn || (an == bn && mpn_cmp(a->d, b->d, an) < 0)) {
+    bigz_struct *t = a; a = b, b = t;
+    rn = an, an = bn, bn = rn;
+    asign ^= bsign, bsign ^= asign, asign ^= bsign;
+  }
+
+  /* |a| >= |b| */
+  rp = bigz_alloc_limbs(an + 1);
+
+  if (asign == bsign) {
+    rp[an] = (bn > 0) ? mpn_add(rp, a->d, an, b->d, bn) : 0;
+    if (bn == 0) memcpy(rp, a->d, BIGZ_BYTES(an));
+    rn = an + (rp[an] != 0);
+  } else {
+    if (bn > 0)
+      mpn_sub(rp, a->d, an, b->d, bn);
+    else
+      memcpy(rp, a->d, BIGZ_BYTES(an));
+    rn = an;
+    while (rn > 0 && rp[rn-1] == 0) rn--;
+  }
+
+  bigz_set_limbs(r, rp, an + 1, asign ? -rn : rn);
+}
+
+/* r += a*x */
+void bigz_addmul_ui (bigz_t r, bigz_t a, mp_limb_t x)
+{
+  bigz_t t;
+
+  bigz_init(t);
+  bigz_mul_ui(t, a, x);
+  bigz_add(r, r, t);
+  bigz_clear(t);
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+// Fixed-point final stage, n limbs after the radix point. The results are
+// bigz_t holding the fixed-point value scaled to an integer.
+
+/* t = |num|/|den| * 2^(64(n+1)) */
+void bigz_fix_div (bigz_t t, bigz_t num, bigz_t den, mp_size_t n)
+{
+  mp_size_t sn, sd, nn, dn, xn, tn, l;
+  mp_ptr np, dp, xp, rp, tp;
+
+  /* use the most significant n+2 limbs of num and den */
+  nn = min(BIGZ_ABS(num->size), n+2), sn = BIGZ_ABS(num->size) - nn;
+  dn = min(BIGZ_ABS(den->size), n+2), sd = BIGZ_ABS(den->size) - dn;
+  np = num->d + sn, dp = den->d + sd;
+
+  /* t = (np * B^l) / dp, l chosen such that t ~ num/den * B^(n+1) */
+  l = max(n + 1 + sn - sd, 0);
+  xn = nn + l;
+
+  if (xn < dn) {
+    t->size = 0;
+    return;
+  }
+
+  xp = bigz_alloc_limbs(xn);
+  rp = bigz_alloc_limbs(dn);
+  tp = bigz_alloc_limbs(xn - dn + 1);
+
+  memset(xp, 0, BIGZ_BYTES(l));
+  memcpy(xp + l, np, BIGZ_BYTES(nn));
+
+  mpn_tdiv_qr(tp, rp, 0, xp, xn, dp, dn);
+  tn = xn - dn + 1;
+
+  bigz_free_limbs(rp, dn);
+  bigz_free_limbs(xp, xn);
+
+  /* drop whole limbs when the exponent could not be reached by l */
+  l -= n + 1 + sn - sd;
+  if (l > 0) {
+    tn = (l < tn) ? tn - l : 0;
+    memmove(tp, tp + l, BIGZ_BYTES(tn));
+  }
+
+  while (tn > 0 && tp[tn-1] == 0) tn--;
+  bigz_set_limbs(t, tp, xn - dn + 1, tn);
+}
+
+/* s = sqrt(x) * 2^(64n) */
+void bigz_fix_sqrt_ui (bigz_t s, mp_limb_t x, mp_size_t n)
+{
+  mp_ptr xp = bigz_alloc_limbs(2*n+1);
+  mp_ptr sp = bigz_alloc_limbs(n+1);
+  mp_size_t sn = n+1;
+
+  memset(xp, 0, BIGZ_BYTES(2*n));
+  xp[2*n] = x;
+
+  mpn_sqrtrem(sp, NULL, xp, 2*n+1);
+  bigz_free_limbs(xp, 2*n+1);
+
+  while (sn > 0 && sp[sn-1] == 0) sn--;
+  bigz_set_limbs(s, sp, n+1, sn);
+}
+
+/* r = t*s / 2^(64(n+1)) */
+void bigz_fix_mul (bigz_t r, bigz_t t, bigz_t s, mp_size_t n)
+{
+  bigz_mul(r, t, s);
+
+  if (BIGZ_ABS(r->size) <= n+1) {
+    r->size = 0;
+  } else {
+    r->size = BIGZ_ABS(r->size) - (n+1);
+    memmove(r->d, r->d + n+1, BIGZ_BYTES(r->size));
+  }
+}
+
+/* rp = base^exp, rp and tp need room for the result plus one limb */
+static mp_size_t bigz_pow_ui (mp_ptr rp, mp_ptr tp, mp_limb_t base, uint64_t exp)
+{
+  mp_ptr r0 = rp, t;
+  mp_size_t rn = 1;
+  int i;
+
+  rp[0] = 1;
+  if (exp == 0)
+    return 1;
+
+  for (i = 63; ((exp >> i) & 1) == 0; i--) ;
+
+  rp[0] = base;
+
+  for (i--; i >= 0; i--) {
+    mpn_sqr(tp, rp, rn);
+    rn = 2*rn; rn -= (tp[rn-1] == 0);
+    t = rp, rp = tp, tp = t;
+
+    if ((exp >> i) & 1) {
+      rp[rn] = mpn_mul_1(rp, rp, rn, base);
+      rn += (rp[rn] != 0);
+    }
+  }
+
+  if (rp != r0)
+    memcpy(r0, rp, BIGZ_BYTES(rn));
+
+  return rn;
+}
+
+/*
+  Decimal string of r, a fixed-point number with n limbs after the radix
+  point. Returns "I.DDD...D" holding digits after the point, truncated.
+  Uses f*10^d / 2^(64n) = f*5^d / 2^(64n-d) for the fraction f.
+*/
+char *bigz_fix_get_str (bigz_t r, mp_size_t n, uint64_t digits)
+{
+  mp_size_t rn = BIGZ_ABS(r->size), fn, pa, pn, xn, off;
+  mp_limb_t ipart = (rn > n) ? r->d[n] : 0;
+  mp_ptr pp, tp, xp;
+  uint64_t shift, ilen, len, i;
+  char ibuf[24], *str;
+
+  snprintf(ibuf, sizeof(ibuf), "%llu", (unsigned long long) ipart);
+  ilen = strlen(ibuf);
+
+  /* mpn_get_str may need room for up to two limbs of extra digits */
+  str = malloc(ilen + digits + 2 + 2*GMP_NUMB_BITS);
+  memcpy(str, ibuf, ilen);
+  str[ilen] = '.';
+
+  fn = min(rn, n);
+  while (fn > 0 && r->d[fn-1] == 0) fn--;
+
+  len = 0;
+
+  if (digits > 0 && fn > 0) {
+    /* p = 5^digits */
+    pa = (mp_size_t) (digits * 2.32192809488736234787 / GMP_NUMB_BITS) + 3;
+    pp = bigz_alloc_limbs(pa);
+    tp = bigz_alloc_limbs(pa);
+    pn = bigz_pow_ui(pp, tp, 5, digits);
+    bigz_free_limbs(tp, pa);
+
+    /* x = f*p >> (64n-d) */
+    xn = fn + pn;
+    xp = bigz_alloc_limbs(xn);
+
+    if (fn >= pn)
+      mpn_mul(xp, r->d, fn, pp, pn);
+    else
+      mpn_mul(xp, pp, pn, r->d, fn);
+
+    bigz_free_limbs(pp, pa);
+
+    shift = (uint64_t) n * GMP_NUMB_BITS - digits;
+    off = shift / GMP_NUMB_BITS;
+    pn = xn;
+
+    if (off >= xn) {
+      xn = 0;
+    } else {
+      xn -= off;
+      if (shift % GMP_NUMB_BITS)
+        mpn_rshift(xp, xp + off, xn, shift % GMP_NUMB_BITS);
+      else
+        memmove(xp, xp + off, BIGZ_BYTES(xn));
+      while (xn > 0 && xp[xn-1] == 0) xn--;
+    }
+
+    /* convert, the result has no leading zeros */
+    if (xn > 0)
+      len = mpn_get_str((unsigned char *) str + ilen + 1, 10, xp, xn);
+
+    bigz_free_limbs(xp, pn);
+  }
+
+  if (len > digits)
+    len = digits;
+
+  if (len < digits) {
+    memmove(str + ilen + 1 + (digits - len), str + ilen + 1, len);
+    memset(str + ilen + 1, 0, digits - len);
+  }
+
+  for (i = 0; i < digits; i++)
+    str[ilen + 1 + i] += '0';
+
+  str[ilen + 1 + digits] = 0;
+
+  return str;
+}
+
+#endif /* PGMP_BIGZ_H */
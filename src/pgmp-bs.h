@@ -0,0 +1,529 @@
+#line 2 "../src/pgmp-bs.h"
+/* Sieve, factorization, and binary splitting for hypergeometric series.
+
+ * See pgmp-chudnovsky.h for the list of authors and the license.
+
+ * This file is included once per index width. The includer defines uint_t
+ * (uint32_t or uint64_t) and W(name), which appends the width suffix to
+ * every type, global, and function declared here. E.g. W(bs) is bs_32 or
+ * bs_64. The dispatch routines reside in pgmp-chudnovsky.h. The terms
+ * come from the selected series, see pgmp-series.h.
+ */
+
+typedef struct {
+  uint_t max_facs;
+  uint_t num_facs;
+  uint_t *fac;
+  uint_t *pow;
+} W(fac_t)[1];
+
+typedef struct {
+  uint_t fac;
+  uint_t pow;
+  uint_t nxt;
+} W(sieve_t);
+
+W(sieve_t) *W(sieve);
+uint_t W(sieve_size);
+uint_t W(sieve_ready);                  /* numbers below are sieved */
+
+void W(fac_reset) (W(fac_t) f)
+{
+  f[0].num_facs = 0;
+}
+
+void W(fac_init_size) (W(fac_t) f, uint_t s)
+{
+  if (s < INIT_FACS)
+    s = INIT_FACS;
+
+  f[0].fac = malloc(s*sizeof(uint_t)*2);
+  f[0].pow = f[0].fac + s;
+  f[0].max_facs = s;
+
+  W(fac_reset)(f);
+}
+
+void W(fac_init) (W(fac_t) f)
+{
+  W(fac_init_size)(f, INIT_FACS);
+}
+
+void W(fac_clear) (W(fac_t) f)
+{
+  free(f[0].fac);
+}
+
+void W(fac_resize) (W(fac_t) f, uint_t s)
+{
+  if (f[0].max_facs < s) {
+    W(fac_clear)(f);
+    W(fac_init_size)(f, s);
+  }
+}
+
+/* f = base^pow */
+void W(fac_set_bp) (W(fac_t) f, uint_t base, uint_t pow)
+{
+  uint_t i;
+
+  for (i=0, base/=2; base>0; i++, base = W(sieve)[base].nxt) {
+    f[0].fac[i] = W(sieve)[base].fac;
+    f[0].pow[i] = W(sieve)[base].pow*pow;
+  }
+
+  f[0].num_facs = i;
+}
+
+/* r = f*g */
+void W(fac_mul2) (W(fac_t) r, W(fac_t) f, W(fac_t) g)
+{
+  uint_t i, j, k;
+
+  for (i=j=k=0; i<f[0].num_facs && j<g[0].num_facs; k++) {
+    if (f[0].fac[i] == g[0].fac[j]) {
+      r[0].fac[k] = f[0].fac[i];
+      r[0].pow[k] = f[0].pow[i] + g[0].pow[j];
+      i++; j++;
+    } else if (f[0].fac[i] < g[0].fac[j]) {
+      r[0].fac[k] = f[0].fac[i];
+      r[0].pow[k] = f[0].pow[i];
+      i++;
+    } else {
+      r[0].fac[k] = g[0].fac[j];
+      r[0].pow[k] = g[0].pow[j];
+      j++;
+    }
+  }
+  for (; i<f[0].num_facs; i++, k++) {
+    r[0].fac[k] = f[0].fac[i];
+    r[0].pow[k] = f[0].pow[i];
+  }
+  for (; j<g[0].num_facs; j++, k++) {
+    r[0].fac[k] = g[0].fac[j];
+    r[0].pow[k] = g[0].pow[j];
+  }
+
+  r[0].num_facs = k;
+}
+
+/* f *= g */
+void W(fac_mul) (W(fac_t) f, W(fac_t) g, W(fac_t) fmul)
+{
+  W(fac_t) tmp;
+  W(fac_resize)(fmul, f[0].num_facs + g[0].num_facs);
+  W(fac_mul2)(fmul, f, g);
+  tmp[0]  = f[0];
+  f[0]    = fmul[0];
+  fmul[0] = tmp[0];
+}
+
+/* f *= base^pow */
+void W(fac_mul_bp) (W(fac_t) f, uint_t base, uint_t pow, W(fac_t) ftmp, W(fac_t) fmul)
+{
+  W(fac_set_bp)(ftmp, base, pow);
+  W(fac_mul)(f, ftmp, fmul);
+}
+
+/* f = factors of a term, ignoring factors of two */
+void W(fac_set_term) (W(fac_t) f, term_fac_t *t, W(fac_t) ftmp, W(fac_t) fmul)
+{
+  uint64_t base;
+  int i, n;
+
+  W(fac_reset)(f);
+
+  for (i = n = 0; i < t->num; i++) {
+    for (base = t->base[i]; base > 0 && (base & 1) == 0; base >>= 1) ;
+
+    if (base <= 1 || t->pow[i] == 0)
+      continue;
+
+    if (n++ == 0)
+      W(fac_set_bp)(f, base, t->pow[i]);
+    else
+      W(fac_mul_bp)(f, base, t->pow[i], ftmp, fmul);
+  }
+}
+
+/* remove factors of power 0 */
+void W(fac_compact) (W(fac_t) f)
+{
+  uint_t i, j;
+
+  for (i=0, j=0; i<f[0].num_facs; i++) {
+    if (f[0].pow[i]>0) {
+      if (j<i) {
+        f[0].fac[j] = f[0].fac[i];
+        f[0].pow[j] = f[0].pow[i];
+      }
+      j++;
+    }
+  }
+
+  f[0].num_facs = j;
+}
+
+/* convert factorized form to number */
+void W(bs_mul) (mpz_t r, uint_t a, uint_t b, W(fac_t) fmul)
+{
+  uint_t i, j;
+
+  if (b-a<=32) {
+    mpz_set_ui(r, 1);
+    for (i=a; i<b; i++)
+      for (j=0; j<fmul[0].pow[i]; j++)
+        mpz_mul_ui(r, r, fmul[0].fac[i]);
+  } else {
+    mpz_t r2;
+    mpz_init(r2);
+    W(bs_mul)(r2, a, (a+b)/2, fmul);
+    W(bs_mul)(r, (a+b)/2, b, fmul);
+    my_mul(r, r, r2);
+    mpz_clear(r2);
+  }
+}
+
+/* f /= gcd(f,g), g /= gcd(f,g) */
+void W(fac_remove_gcd) (mpz_t p, W(fac_t) fp, mpz_t g, W(fac_t) fg, mpz_t gcd, W(fac_t) fmul)
+{
+  uint_t i, j, k, c;
+
+  W(fac_resize)(fmul, min(fp->num_facs, fg->num_facs));
+
+  for (i=j=k=0; i<fp->num_facs && j<fg->num_facs; ) {
+    if (fp->fac[i] == fg->fac[j]) {
+      c = min(fp->pow[i], fg->pow[j]);
+      fp->pow[i] -= c;
+      fg->pow[j] -= c;
+      fmul->fac[k] = fp->fac[i];
+      fmul->pow[k] = c;
+      i++; j++; k++;
+    } else if (fp->fac[i] < fg->fac[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+
+  fmul->num_facs = k;
+
+  if (fmul->num_facs) {
+    W(bs_mul)(gcd, 0, fmul->num_facs, fmul);
+    divexact2(p, g, gcd);
+    W(fac_compact)(fp);
+    W(fac_compact)(fg);
+  }
+}
+
+void W(build_sieve) (uint_t n, W(sieve_t) *s)
+{
+  uint_t m, i, j, k;
+
+  m = (uint_t) sqrt(n);
+  memset(s, 0, sizeof(W(sieve_t))*n/2);
+
+  s[1/2].fac = 1;
+  s[1/2].pow = 1;
+
+  for (i=3; i<=n; i+=2) {
+    if (s[i/2].fac == 0) {
+      s[i/2].fac = i;
+      s[i/2].pow = 1;
+      if (i<=m) {
+        for (j=i*i, k=i/2; j<=n; j+=i+i, k++) {
+          if (s[j/2].fac==0) {
+            s[j/2].fac = i;
+            if (s[k].fac == i) {
+              s[j/2].pow = s[k].pow + 1;
+              s[j/2].nxt = s[k].nxt;
+            } else {
+              s[j/2].pow = 1;
+              s[j/2].nxt = k;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+/*
+  sieve the odd numbers in [lo,hi) with the primes below lo, given by
+  pr[0..np), lo and hi even; the powers and the next factor follow from
+  the multiple j/i, tracked mod i, so that no other segment is read
+*/
+void W(sieve_segment) (uint_t lo, uint_t hi, const uint_t *pr, uint_t np, W(sieve_t) *s)
+{
+  uint64_t i, j, k, c, q, pw;
+  uint_t x;
+
+  memset(s + lo/2, 0, sizeof(W(sieve_t))*(hi-lo)/2);
+
+  for (x = 0; x < np && (uint64_t) pr[x] * pr[x] < hi; x++) {
+    i = pr[x];
+    j = max(i*i, (lo + i - 1) / i * i);
+    if ((j & 1) == 0) j += i;
+
+    for (k = j/i, c = k % i; j < hi; j += i+i, k += 2, c = (c+2 < i) ? c+2 : c+2-i) {
+      if (s[j/2].fac == 0) {
+        s[j/2].fac = i;
+        if (c != 0) {
+          s[j/2].pow = 1;
+          s[j/2].nxt = k/2;
+        } else {
+          for (q = k/i, pw = 2; q % i == 0; q /= i) pw++;
+          s[j/2].pow = pw;
+          s[j/2].nxt = q/2;
+        }
+      }
+    }
+  }
+
+  for (j = lo+1; j < hi; j += 2) {
+    if (s[j/2].fac == 0) {
+      s[j/2].fac = j;
+      s[j/2].pow = 1;
+    }
+  }
+}
+
+/* allocate the sieve for the given number of terms, build the first segment */
+void W(sieve_init) (uint_t terms)
+{
+  uint_t n = max(series->sieve_min, terms*series->sieve_mul), n0;
+
+  n += n & 1;                   /* build_sieve needs n even */
+  n0 = min(n, max(SIEVE_SEGMENT, (uint_t) sqrt(n) + 2));
+  n0 += n0 & 1;
+
+  W(sieve) = (W(sieve_t) *) malloc(sizeof(W(sieve_t))*n/2);
+  W(sieve_size) = n;
+  W(build_sieve)(n0, W(sieve));
+  W(sieve_ready) = n0;
+}
+
+/* build the remaining segments in order, publishing each, see sieve_wait */
+void W(sieve_fill) ()
+{
+  uint_t n = W(sieve_size), lo = W(sieve_ready), hi, i, np = 0;
+  uint_t *pr = malloc(sizeof(uint_t)*(lo/2));
+
+  for (i = 3; i < lo; i += 2)
+    if (W(sieve)[i/2].fac == i)
+      pr[np++] = i;
+
+  for (; lo < n; lo = hi) {
+    hi = (n - lo > SIEVE_SEGMENT) ? lo + SIEVE_SEGMENT : n;
+    W(sieve_segment)(lo, hi, pr, np, W(sieve));
+    __atomic_store_n(&W(sieve_ready), hi, __ATOMIC_RELEASE);
+  }
+
+  free(pr);
+}
+
+/* wait until the bases of term k and below are sieved, see pgmp-series.h */
+void W(sieve_wait) (uint_t k)
+{
+  uint_t n = min(W(sieve_size), max(series->sieve_min, k*series->sieve_mul));
+
+  while (__atomic_load_n(&W(sieve_ready), __ATOMIC_ACQUIRE) < n)
+    sched_yield();
+}
+
+void W(sieve_free) ()
+{
+  free(W(sieve));
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+// binary splitting
+
+typedef struct {
+  mpz_t p, q, g;
+  pow2_t e;
+  W(fac_t) fp, fg;
+  int cleared;
+} W(tmp_t);
+
+#define  pj tmp[j].p
+#define  qj tmp[j].q
+#define  gj tmp[j].g
+#define fpj tmp[j].fp
+#define fgj tmp[j].fg
+#define  ej tmp[j].e
+
+/*
+  bs over (a,b] on the stack s, see bs_size. The outputs p1, q1, g1 are
+  apart from the operands of the merge and large enough for it.
+*/
+void W(bs_stack) (mpz_t p1, mpz_t q1, mpz_t g1, pow2_t *e1, W(fac_t) fp1, W(fac_t) fg1, uint_t a, uint_t b, uint_t terms, uint_t level, mpz_t gcd, W(fac_t) ftmp, W(fac_t) fmul, W(tmp_t) *tmp, uint_t j, bs_stack_t *s)
+{
+  uint_t mid;
+
+  if (b-a == 1) {
+    term_fac_t tp, tg;
+
+    W(sieve_wait)(b);
+    series->term(s->p, s->q, s->g, &tp, &tg, b);
+
+    e1->p = pow2_strip(s->p);
+    e1->q = pow2_strip(s->q);
+    e1->g = pow2_strip(s->g);
+
+    mpz_set(p1, s->p), mpz_set(q1, s->q), mpz_set(g1, s->g);
+
+    W(fac_set_term)(fp1, &tp, ftmp, fmul);
+    W(fac_set_term)(fg1, &tg, ftmp, fmul);
+
+  } else {
+    mpz_t pl, ql, gl, pr, qr, gr, t;
+    mp_size_t pn, qn, gn;
+    pow2_t el, er;
+    size_t top = s->top;
+
+    mid = a + (b-a) * 0.54;  /* tuning parameter */
+
+    bs_size(a, mid, &pn, &qn, &gn);
+    bs_stack_mpz(s, pl, pn), bs_stack_mpz(s, ql, qn), bs_stack_mpz(s, gl, gn);
+
+    W(bs_stack)(pl, ql, gl, &el, fp1, fg1, a, mid, terms, level+1,
+      gcd, ftmp, fmul, tmp, j, s);
+
+    bs_size(mid, b, &pn, &qn, &gn);
+    bs_stack_mpz(s, pr, pn), bs_stack_mpz(s, qr, qn), bs_stack_mpz(s, gr, gn);
+
+    W(bs_stack)(pr, qr, gr, &er, fpj, fgj, mid, b, terms, level+1,
+      gcd, ftmp, fmul, tmp, j+1, s);
+
+    if (level >= 4)          /* tuning parameter */
+      W(fac_remove_gcd)(pr, fpj, gl, fg1, gcd, fmul);
+
+    bs_size(a, b, &pn, &qn, &gn);
+    bs_stack_mpz(s, t, qn);
+
+    my_mul(t, qr, gl), er.q += el.g;
+    my_mul(q1, ql, pr), e1->q = el.q + er.p;
+    pow2_add(q1, &e1->q, t, er.q);
+
+    my_mul(p1, pl, pr), e1->p = el.p + er.p;
+    W(fac_mul)(fp1, fpj, fmul);
+
+    if (b < terms) {
+      my_mul(g1, gl, gr), e1->g = el.g + er.g;
+      W(fac_mul)(fg1, fgj, fmul);
+    } else {
+      mpz_set(g1, gl), e1->g = el.g;
+    }
+
+    s->top = top;
+  }
+}
+
+void W(bs) (mpz_t p1, mpz_t q1, mpz_t g1, pow2_t *e1, W(fac_t) fp1, W(fac_t) fg1, uint_t a, uint_t b, uint_t terms, uint_t level, mpz_t gcd, W(fac_t) ftmp, W(fac_t) fmul, W(tmp_t) *tmp, uint_t j, int clear_flag, bs_stack_t *s)
+{
+  mp_size_t pn, qn, gn;
+  uint_t mid;
+
+  bs_size(a, b, &pn, &qn, &gn);
+
+  if (pn + qn + gn <= BS_STACK_LIMBS) {
+    W(bs_stack)(p1, q1, g1, e1, fp1, fg1, a, b, terms, level,
+      gcd, ftmp, fmul, tmp, j, s);
+
+  } else {
+    /*
+      p(a,b) = p(a,m) * p(m,b)
+      g(a,b) = g(a,m) * g(m,b)
+      q(a,b) = q(a,m) * p(m,b) + q(m,b) * g(a,m)
+    */
+    mid = a + (b-a) * 0.54;  /* tuning parameter */
+
+    W(bs)(p1, q1, g1, e1, fp1, fg1, a, mid, terms, level+1,
+      gcd, ftmp, fmul, tmp, j, 0, s);
+
+    W(bs)(pj, qj, gj, &ej, fpj, fgj, mid, b, terms, level+1,
+      gcd, ftmp, fmul, tmp, j+1, 0, s);
+
+    if (level >= 4)          /* tuning parameter */
+      W(fac_remove_gcd)(pj, fpj, g1, fg1, gcd, fmul);
+
+    qn = pow2_add_size(q1, pj, e1->q + ej.p, qj, g1, ej.q + e1->g);
+
+    mul_swap(qj, qj, g1, qn), ej.q += e1->g;
+    W(fac_mul)(fp1, fpj, fmul);
+
+    if (b < terms) {
+      mul_swap(g1, g1, gj, mpz_size(g1) + mpz_size(gj)), e1->g += ej.g;
+      W(fac_mul)(fg1, fgj, fmul);
+    }
+    if (clear_flag) {
+      W(fac_clear)(fpj), W(fac_clear)(fgj), mpz_clear(gj);
+      tmp[j].cleared = 1;
+    }
+
+    mul_swap(q1, q1, pj, qn), e1->q += ej.p;
+    pow2_add(q1, &e1->q, qj, ej.q);
+
+    if (clear_flag) mpz_clear(qj);
+
+    mul_swap(p1, p1, pj, mpz_size(p1) + mpz_size(pj)), e1->p += ej.p;
+
+    if (clear_flag) mpz_clear(pj);
+  }
+}
+
+#undef  pj
+#undef  qj
+#undef  gj
+#undef fpj
+#undef fgj
+#undef  ej
+
+/*
+  binary splitting over [a,b), results stored in p1, q1, g1, with the
+  powers of two in e1, or multiplied back in when e1 is NULL
+*/
+void W(bs_range) (mpz_t p1, mpz_t q1, mpz_t g1, uint_t a, uint_t b, uint_t terms, uint_t level, uint_t depth, pow2_t *e1)
+{
+  W(fac_t) fp1, fg1, ftmp, fmul; mpz_t gcd;
+  mp_size_t pn, qn, gn;
+  bs_stack_t s;
+  pow2_t e;
+  uint_t j;
+
+  W(fac_init)(fp1), W(fac_init)(ftmp), mpz_init(gcd);
+  W(fac_init)(fg1), W(fac_init)(fmul);
+
+  W(tmp_t) *tmp = (W(tmp_t) *) malloc(sizeof(W(tmp_t)) * (depth - 1));
+
+  for (j = 0; j < depth - 1; j++) {
+    mpz_init(tmp[j].p),     mpz_init(tmp[j].q),     mpz_init(tmp[j].g);
+    W(fac_init)(tmp[j].fp), W(fac_init)(tmp[j].fg), tmp[j].cleared = 0;
+  }
+
+  bs_size(a, b, &pn, &qn, &gn);
+  bs_stack_init(&s, pn + qn + gn);
+
+  W(bs)(p1, q1, g1, &e, fp1, fg1, a, b, terms, level, gcd, ftmp, fmul, tmp, 0, 1, &s);
+
+  bs_stack_clear(&s);
+
+  if (e1 != NULL)
+    *e1 = e;
+  else
+    pow2_apply(p1, q1, g1, &e);
+
+  for (j = 0; j < depth - 1; j++) {
+    if (!tmp[j].cleared) {
+      mpz_clear(tmp[j].p),     mpz_clear(tmp[j].q),     mpz_clear(tmp[j].g);
+      W(fac_clear)(tmp[j].fp), W(fac_clear)(tmp[j].fg);
+    }
+  }
+
+  free(tmp);
+
+  W(fac_clear)(fp1), W(fac_clear)(ftmp), mpz_clear(gcd);
+  W(fac_clear)(fg1), W(fac_clear)(fmul);
+}
@@ -0,0 +1,228 @@
+#line 2 "../src/pgmp-budget.h"
+/* Deadline mode, pi-gmp.exe --time-budget <seconds> [ ... ].
+
+ * See pgmp-chudnovsky.h for the list of authors and the license.
+
+ * budget_select picks the largest digit count whose predicted wallclock
+ * fits what the calibration leaves of the budget. The computation, sieve to final mul, is timed on runs
+ * in forked children, doubling the digits until a run takes more than
+ * BUDGET_CAL_SHARE of the budget. mpz_mul and the output conversion are
+ * timed in the parent afterwards, as children of a process running OpenMP
+ * threads are not safe. Both parts are extrapolated with the growth of
+ * M(n) log n for n limbs, M taken from the mpz_mul timings and grown as
+ * n log n past the largest product timed.
+ */
+
+#ifndef PGMP_BUDGET_H
+#define PGMP_BUDGET_H
+
+#if defined(_WIN32)
+#error "--time-budget requires fork"
+#endif
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define BUDGET_CAL_SHARE   0.01    /* of the budget, per calibration */
+#define BUDGET_CAL_MIN     0.05    /* seconds */
+#define BUDGET_MUL_TIME    0.5     /* stop timing once a product takes longer */
+#define BUDGET_MIN_DIGITS  10000
+#define BUDGET_MIN_CLASS   10      /* 2^10 limbs */
+#define BUDGET_MAX_CLASS   40
+
+int    budget_child = 0;           /* set in the calibration children */
+double budget_compute, budget_output, budget_cal;
+
+/* mpz_mul wallclock per size class 2^k limbs */
+double budget_mul[BUDGET_MAX_CLASS+1];
+int    budget_top = 0;
+
+void budget_fill (mpz_t z, mp_size_t n)
+{
+  static uint64_t x = 88172645463325252ULL;
+  mp_size_t i;
+
+  mpz_realloc2(z, (mp_bitcnt_t) n * GMP_NUMB_BITS);
+
+  for (i = 0; i < n; i++)
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17, z->_mp_d[i] = (mp_limb_t) x;
+
+  z->_mp_d[n-1] |= 1;
+  z->_mp_size = n;
+}
+
+/* wallclock of an n x n limb product */
+double budget_mul_time (double n)
+{
+  double k = log2(max(n, 1.0)), f;
+  int    j;
+
+  if (k <= BUDGET_MIN_CLASS)
+    return budget_mul[BUDGET_MIN_CLASS] * n / (1 << BUDGET_MIN_CLASS);
+
+  if (k >= budget_top)
+    return budget_mul[budget_top] * n / ldexp(1.0, budget_top) * k / budget_top;
+
+  /* geometric interpolation between the classes around n */
+  j = (int) k, f = k - j;
+  return budget_mul[j] * pow(budget_mul[j+1] / budget_mul[j], f);
+}
+
+/* growth of the work for the given digits, M(n) log n */
+double budget_growth (uint64_t digits)
+{
+  double n = digits * BITS_PER_DIGIT / GMP_NUMB_BITS + 1;
+  return budget_mul_time(n) * log2(n);
+}
+
+/* wallclock of a run of the given digits in a child, without output;
+   returns -1 in the child, which carries on in main */
+double budget_run (uint64_t digits)
+{
+  double t = wall_clock();
+  int    status, fd;
+  pid_t  pid;
+
+  fflush(stdout), fflush(stderr);
+
+  if ((pid = fork()) == 0) {
+    if ((fd = open("/dev/null", O_WRONLY)) >= 0)
+      dup2(fd, 1), dup2(fd, 2), close(fd);
+    budget_child = 1;
+    return -1.0;
+  }
+
+  if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr,"Calibration run of %llu digits failed\n",
+      (unsigned long long) digits);
+    exit(1);
+  }
+
+  return wall_clock()-t;
+}
+
+/* time products up to BUDGET_MUL_TIME or the calibration share */
+void budget_mul_init (double cal)
+{
+  mpz_t a, b, r;
+  double t;
+  int k, i;
+
+  mpz_init(a), mpz_init(b), mpz_init(r);
+
+  for (k = BUDGET_MIN_CLASS; k <= BUDGET_MAX_CLASS; k++) {
+    budget_fill(a, (mp_size_t) 1 << k);
+    budget_fill(b, (mp_size_t) 1 << k);
+
+    budget_mul[k] = 1e30;
+
+    for (i = 0; i < 3; i++) {
+      t = wall_clock();
+      mpz_mul(r, a, b);
+      t = wall_clock()-t;
+      if (t < budget_mul[k]) budget_mul[k] = t;
+      if (t > BUDGET_CAL_MIN) break;
+    }
+
+    budget_top = k;
+
+    if (budget_mul[k] > min(cal, BUDGET_MUL_TIME))
+      break;
+  }
+
+  mpz_clear(a), mpz_clear(b), mpz_clear(r);
+}
+
+/* wallclock of mpf_get_digits on the given digits, which are returned
+   grown until the conversion takes the calibration share */
+double budget_str_init (double cal, uint64_t *digits)
+{
+  mpf_t x;
+  mpz_t z;
+  uint64_t d;
+  double t = 0.0;
+  mp_size_t n;
+  char *str;
+
+  mpz_init(z);
+
+  for (d = BUDGET_MIN_DIGITS; t <= cal; d *= 2) {
+    n = (mp_size_t) (d * BITS_PER_DIGIT / GMP_NUMB_BITS) + 2;
+
+    /* 3.xxx with n random limbs after the radix point */
+    budget_fill(z, n);
+    mpf_init2(x, (mp_bitcnt_t) (n + 1) * GMP_NUMB_BITS);
+    mpf_set_z(x, z);
+    mpf_div_2exp(x, x, (mp_bitcnt_t) n * GMP_NUMB_BITS);
+    mpf_add_ui(x, x, 3);
+
+    t = wall_clock();
+    str = mpf_get_digits(x, d);
+    t = wall_clock()-t;
+
+    free(str), mpf_clear(x);
+    *digits = d;
+  }
+
+  mpz_clear(z);
+
+  return t;
+}
+
+/* the largest digits predicted to fit the budget, or the digits of a
+   calibration run when returning in a child */
+uint64_t budget_select (double budget, int out, uint64_t max_digits)
+{
+  double begin = wall_clock(), cal, rest, tc = 0.0, tp = 0.0, ts = 0.0, gc, gs, fc;
+  uint64_t d, dc, ds = 0, lo, hi;
+
+  cal = max(budget * BUDGET_CAL_SHARE, BUDGET_CAL_MIN);
+
+  for (dc = BUDGET_MIN_DIGITS; ; dc *= 2) {
+    tp = tc;
+    if ((tc = budget_run(dc)) < 0.0)
+      return dc;
+    if (tc > cal || dc * 2 > max_digits)
+      break;
+  }
+
+  budget_mul_init(cal);
+
+  if (out)
+    ts = budget_str_init(cal, &ds);
+
+  /* the last two runs separate the fixed cost of a run, startup and
+     small terms, from the growth */
+  gc = (tc - tp) / (budget_growth(dc) - budget_growth(dc / 2));
+  fc = tc - gc * budget_growth(dc);
+
+  if (dc == BUDGET_MIN_DIGITS || gc <= 0.0 || fc < 0.0)
+    gc = tc / budget_growth(dc), fc = 0.0;
+
+  gs = out ? ts / budget_growth(ds) : 0.0;
+
+  /* the predicted time grows with the digits, bisect within the rest of
+     the budget, at least the digits of the last calibration run */
+  rest = budget - (wall_clock()-begin);
+
+  for (lo = dc, hi = max_digits; lo < hi; ) {
+    d = lo + (hi - lo + 1) / 2;
+    if (fc + (gc + gs) * budget_growth(d) <= rest)
+      lo = d;
+    else
+      hi = d - 1;
+  }
+
+  budget_compute = fc + gc * budget_growth(lo);
+  budget_output  = gs * budget_growth(lo);
+  budget_cal     = wall_clock()-begin;
+
+  fprintf(stderr,"# time budget = %.1fs, calibration = %.1fs (%llu digits in %.2fs)\n",
+    budget, budget_cal, (unsigned long long) dc, tc);
+
+  return lo;
+}
+
+#endif /* PGMP_BUDGET_H */
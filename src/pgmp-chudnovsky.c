@@ -37,6 +37,7 @@
  */
 
 #include "pgmp-chudnovsky.h"
+#include "pgmp-bigz.h"
 
 #if defined(_OPENMP)
 # include <omp.h>
@@ -46,11 +47,23 @@
 # define omp_get_num_procs()   1
 #endif
 
+#if defined(USE_DECIMAL)
+# include "pgmp-dec.h"
+#endif
+
+#if !defined(_WIN32)
+# include "pgmp-budget.h"
+#endif
+
+#include "pgmp-sink.h"
+
 char   *prog_name;
 double bs1_time=0.0, bs2_time=0.0, div_time=0.0;
 double total_cputime = 0.0, total_wallclock = 0.0;
 
 mpz_t  *pstack, *qstack, *gstack;
+pow2_t *estack;
+bigz_t *pbigz, *qbigz, *gbigz;
 
 #define pi pstack[i]
 #define qi qstack[i]
@@ -58,27 +71,32 @@ mpz_t  *pstack, *qstack, *gstack;
 #define pk pstack[k]
 #define qk qstack[k]
 #define gk gstack[k]
+#define ei estack[i]
+#define ek estack[k]
 
-void sum (uint_t i, uint_t k, int gflag)
+void sum (uint64_t i, uint64_t k, int gflag)
 {
+  /* room for the shift and add of q, see pow2_add_size */
+  mp_size_t qn = pow2_add_size(qi, pk, ei.q + ek.p, qk, gi, ek.q + ei.g);
+
  #if defined(_OPENMP)
 
   #pragma omp task
   {
     double t = wall_clock();
-    mpz_mul(pi, pi, pk);
+    mul_swap(pi, pi, pk, mpz_size(pi) + mpz_size(pk));
     bs2_time += wall_clock()-t;
   }
   #pragma omp task
   {
     double t = wall_clock();
-    mpz_mul(qi, qi, pk);
+    mul_swap(qi, qi, pk, qn);
     bs2_time += wall_clock()-t;
   }
   #pragma omp task
   {
     double t = wall_clock();
-    mpz_mul(qk, qk, gi);
+    mul_swap(qk, qk, gi, qn);
     bs2_time += wall_clock()-t;
   }
 
@@ -88,11 +106,13 @@ void sum (uint_t i, uint_t k, int gflag)
 
     mpz_clear(pk);
 
-    mpz_add(qi, qi, qk);
+    ei.p += ek.p, ei.q += ek.p, ek.q += ei.g;
+
+    pow2_add(qi, &ei.q, qk, ek.q);
     mpz_clear(qk);
 
     if (gflag)
-      mpz_mul(gi, gi, gk);
+      mul_swap(gi, gi, gk, mpz_size(gi) + mpz_size(gk)), ei.g += ek.g;
 
     mpz_clear(gk);
 
@@ -102,18 +122,18 @@ void sum (uint_t i, uint_t k, int gflag)
  #else
   double t = wall_clock();
 
-  mpz_mul(qk, qk, gi);
+  mul_swap(qk, qk, gi, qn), ek.q += ei.g;
 
   if (gflag)
-    mpz_mul(gi, gi, gk);
+    mul_swap(gi, gi, gk, mpz_size(gi) + mpz_size(gk)), ei.g += ek.g;
 
   mpz_clear(gk);
 
-  mpz_mul(qi, qi, pk);
-  mpz_add(qi, qi, qk);
+  mul_swap(qi, qi, pk, qn), ei.q += ek.p;
+  pow2_add(qi, &ei.q, qk, ek.q);
   mpz_clear(qk);
 
-  mpz_mul(pi, pi, pk);
+  mul_swap(pi, pi, pk, mpz_size(pi) + mpz_size(pk)), ei.p += ek.p;
   mpz_clear(pk);
 
   bs2_time += wall_clock()-t;
@@ -121,34 +141,100 @@ void sum (uint_t i, uint_t k, int gflag)
  #endif
 }
 
-void bs_init (uint_t a, uint_t b, uint_t terms, uint_t level, uint_t i, uint_t depth)
+#undef pi
+#undef qi
+#undef gi
+#undef pk
+#undef qk
+#undef gk
+#undef ei
+#undef ek
+
+// Same as sum, for the top levels beyond the mpz_t size limit.
+
+#define pi pbigz[i]
+#define qi qbigz[i]
+#define gi gbigz[i]
+#define pk pbigz[k]
+#define qk qbigz[k]
+#define gk gbigz[k]
+
+void sum_bigz (uint64_t i, uint64_t k, int gflag)
 {
-  fac_t fp1, fg1, ftmp, fmul; mpz_t gcd;
-  uint_t j;
+ #if defined(_OPENMP)
 
-  fac_init(fp1), fac_init(ftmp), mpz_init(gcd);
-  fac_init(fg1), fac_init(fmul);
+  #pragma omp task
+  {
+    double t = wall_clock();
+    bigz_mul(pi, pi, pk);
+    bs2_time += wall_clock()-t;
+  }
+  #pragma omp task
+  {
+    double t = wall_clock();
+    bigz_mul(qi, qi, pk);
+    bs2_time += wall_clock()-t;
+  }
+  #pragma omp task
+  {
+    double t = wall_clock();
+    bigz_mul(qk, qk, gi);
+    bs2_time += wall_clock()-t;
+  }
 
-  tmp_t *tmp = (tmp_t *) malloc(sizeof(tmp_t) * (depth - 1));
+  #pragma omp taskwait
+  {
+    double t = wall_clock();
 
-  for (j = 0; j < depth - 1; j++) {
-    mpz_init(tmp[j].p),  mpz_init(tmp[j].q),  mpz_init(tmp[j].g);
-    fac_init(tmp[j].fp), fac_init(tmp[j].fg), tmp[j].cleared = 0;
-  }
+    bigz_clear(pk);
 
-  bs(pi, qi, gi, fp1, fg1, a, b, terms, level, gcd, ftmp, fmul, tmp, 0, 1);
+    bigz_add(qi, qi, qk);
+    bigz_clear(qk);
 
-  for (j = 0; j < depth - 1; j++) {
-    if (!tmp[j].cleared) {
-      mpz_clear(tmp[j].p),  mpz_clear(tmp[j].q),  mpz_clear(tmp[j].g);
-      fac_clear(tmp[j].fp), fac_clear(tmp[j].fg);
-    }
+    if (gflag)
+      bigz_mul(gi, gi, gk);
+
+    bigz_clear(gk);
+
+    bs2_time += wall_clock()-t;
   }
 
-  free(tmp);
+ #else
+  double t = wall_clock();
+
+  bigz_mul(qk, qk, gi);
+
+  if (gflag)
+    bigz_mul(gi, gi, gk);
+
+  bigz_clear(gk);
+
+  bigz_mul(qi, qi, pk);
+  bigz_add(qi, qi, qk);
+  bigz_clear(qk);
+
+  bigz_mul(pi, pi, pk);
+  bigz_clear(pk);
+
+  bs2_time += wall_clock()-t;
+
+ #endif
+}
+
+#undef pi
+#undef qi
+#undef gi
+#undef pk
+#undef qk
+#undef gk
+
+#define pi pstack[i]
+#define qi qstack[i]
+#define gi gstack[i]
 
-  fac_clear(fp1), fac_clear(ftmp), mpz_clear(gcd);
-  fac_clear(fg1), fac_clear(fmul);
+void bs_init (uint64_t a, uint64_t b, uint64_t terms, uint64_t level, uint64_t i, uint64_t depth)
+{
+  bs_range(pi, qi, gi, a, b, terms, level, depth, &estack[i]);
 }
 
 void display_time (char *desc, double cputime, double wallclock)
@@ -180,6 +266,58 @@ void display_time (char *desc, double cputime, double wallclock)
   fflush(stderr);
 }
 
+// Final step beyond the mpz_t size limit, same as in main. The result r
+// holds pi in fixed point with n limbs after the radix point.
+
+void final_bigz (bigz_t r, mp_size_t n, int nthrs)
+{
+  double wbegin, wend;
+  bigz_t ci;
+
+  wbegin = wall_clock();
+
+ #if defined(_OPENMP)
+ #pragma omp parallel shared(r,ci) reduction(+:div_time) num_threads(nthrs)
+  {
+ #endif
+    int tid = omp_get_thread_num();
+
+    if (tid == 0) {
+      double t = wall_clock();
+      bigz_fix_div(r, pbigz[0], qbigz[0], n);
+      bigz_clear(pbigz[0]), bigz_clear(qbigz[0]);
+      div_time += wall_clock()-t;
+    }
+    if ((tid == 1 || omp_get_num_threads() < 2) && series->root > 1) {
+      double t = wall_clock();
+      bigz_init(ci);
+      bigz_fix_sqrt_ui(ci, series->root, n);
+      div_time += wall_clock()-t;
+    }
+
+ #if defined(_OPENMP)
+  }
+ #endif
+
+  free(pbigz), free(qbigz);
+
+  wend = wall_clock();
+  display_time("div/sqrt", div_time, wend-wbegin);
+  wbegin = wall_clock();
+
+  if (series->root > 1) {
+    bigz_fix_mul(r, r, ci, n);
+    bigz_clear(ci);
+  } else if (r->size > 0) {
+    /* drop the extra limb of bigz_fix_div */
+    r->size--;
+    memmove(r->d, r->d + 1, BIGZ_BYTES(r->size));
+  }
+
+  wend = wall_clock();
+  display_time("mul", wend-wbegin, wend-wbegin);
+}
+
 #undef pi
 #undef qi
 #undef gi
@@ -187,12 +325,21 @@ void display_time (char *desc, double cputime, double wallclock)
 int main (int argc, char *argv[])
 {
   mpf_t pi, qi, ci;
+  bigz_t qz;
 
   uint64_t digits=100;
-  int      out=0, threads=1, ncpus=omp_get_num_procs(), nthrs;
-  uint_t   terms, i, k, mid, depth, cores_depth, cores_size;
-  uint_t   psize, qsize;
-  double   wbegin, wend;
+  int      out=0, threads=1, ncpus=omp_get_num_procs(), nthrs, huge;
+  int      ncores, sum_thrs=0, div_thrs=0, str_thrs=0, spliced=0;
+  uint64_t terms, i, k, mid, depth, parts, cores_depth, cores_size;
+  uint64_t psize, qsize, pdigits;
+  mp_size_t n = 0;
+  double   wbegin, wend, sieve_wall, fill_time = 0.0, budget = 0.0, run_begin;
+  char     *str;
+
+ #if defined(USE_DECIMAL)
+  mpz_t    dec_num, dec_den;
+  double   bin_time = 0.0;
+ #endif
 
   time_t now; struct tm *localtm;
 
@@ -205,9 +352,14 @@ int main (int argc, char *argv[])
   if (argc == 1) {
     fprintf(stderr,"\n");
     fprintf(stderr,"SYNOPSIS\n");
-    fprintf(stderr,"    %s <digits> [ <option> <threads> ]\n", prog_name);
+    fprintf(stderr,"    %s <digits> [ <option> <threads> <constant> ]\n", prog_name);
+    fprintf(stderr,"    %s --time-budget <seconds> [ ... ]\n", prog_name);
+    fprintf(stderr,"    %s --sink <spec> [ --sink <spec> ... ] <digits> [ ... ]\n", prog_name);
     fprintf(stderr,"\n");
     fprintf(stderr,"    <digits>  digits of Pi to output\n");
+    fprintf(stderr,"    <seconds> the most digits predicted to fit in\n");
+    fprintf(stderr,"    <spec>    raw:<file>, cols:<N>:<file>, packed:<file>,\n");
+    fprintf(stderr,"              md5 or stats, written from one conversion\n");
     fprintf(stderr,"\n");
     fprintf(stderr,"    <option>  0 - just run (default)\n");
     fprintf(stderr,"              1 - output digits only\n");
@@ -217,6 +369,11 @@ int main (int argc, char *argv[])
     fprintf(stderr,"\n");
     fprintf(stderr,"    <threads> number of threads (default 1)\n");
     fprintf(stderr,"              specify 'auto' to run on all cores\n");
+    fprintf(stderr,"              or bs,sum,div,str to set each phase\n");
+    fprintf(stderr,"\n");
+    fprintf(stderr,"    <constant>  pi - Chudnovsky (default)\n");
+    fprintf(stderr,"                ramanujan - pi, Ramanujan\n");
+    fprintf(stderr,"                e, log2, zeta3, catalan\n");
     fprintf(stderr,"\n");
     fprintf(stderr,"EXAMPLES\n");
     fprintf(stderr,"    %s 10000000 1 auto | md5sum\n", prog_name);
@@ -227,16 +384,80 @@ int main (int argc, char *argv[])
     fprintf(stderr,"\n");
     fprintf(stderr,"    %s 100000000 5 auto > pi.txt\n", prog_name);
     fprintf(stderr,"\n");
+    fprintf(stderr,"    %s 100000000 5 auto e > e.txt\n", prog_name);
+    fprintf(stderr,"\n");
 
     exit(1);
   }
 
+  /* leading options, each with a value */
+  while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+    if (argc < 3) {
+      fprintf(stderr,"Option %s requires a value\n", argv[1]);
+      exit(1);
+    }
+    if (strcmp(argv[1], "--time-budget") == 0)
+      budget = atof(argv[2]);
+    else if (strcmp(argv[1], "--sink") == 0)
+      sink_add(argv[2]);
+    else {
+      fprintf(stderr,"Unknown option %s\n", argv[1]);
+      exit(1);
+    }
+    argv += 2, argc -= 2;
+  }
+
+  /* the budget stands in for the digits */
+  if (budget > 0.0)
+    argv--, argc++;
+
   if (argc > 1)
     digits = strtoull(argv[1], NULL, 10);
   if (argc > 2)
     out = atoi(argv[2]);
-  if (argc > 3)
+
+  /* with sinks, the option output to stdout becomes one of them, unless
+     a sink already writes the same to stdout */
+  if (nsinks > 0 && out >= 1 && out <= 14) {
+    static char spec[16];
+    int kind = (out == 1) ? SINK_RAW : SINK_COLS, i;
+
+    for (i = 0; i < nsinks; i++)
+      if (sinks[i].fp == stdout && sinks[i].kind == kind &&
+          (kind == SINK_RAW || sinks[i].columns == out))
+        break;
+
+    if (i == nsinks) {
+      snprintf(spec, sizeof(spec), (out == 1) ? "raw:-" : "cols:%d:-", out);
+      sink_add(spec);
+    }
+  }
+  if (argc > 3) {
     threads = (strncmp(argv[3], "auto", 4) == 0) ? ncpus : atoi(argv[3]);
+    if (strchr(argv[3], ',') != NULL)
+      sscanf(strchr(argv[3], ',') + 1, "%d,%d,%d",
+        &sum_thrs, &div_thrs, &str_thrs);
+  }
+  if (argc > 4 && (series = series_find(argv[4])) == NULL) {
+    fprintf(stderr,"Unknown constant %s\n", argv[4]);
+    exit(1);
+  }
+
+  if (budget > 0.0) {
+   #if defined(_WIN32)
+    fprintf(stderr,"Option --time-budget is not available on Windows\n");
+    exit(1);
+   #else
+    digits = budget_select(budget, (out >= 1 && out <= 14) || nsinks > 0, MAX_DIGITS);
+    if (budget_child)
+      out = 0, nsinks = 0;
+    else
+      fprintf(stderr,"# digits = %s, predicted = %.1fs (compute %.1fs, output %.1fs)\n",
+        commify(digits), budget_compute + budget_output, budget_compute, budget_output);
+   #endif
+  }
+
+  run_begin = wall_clock();
 
   if (digits > MAX_DIGITS) {
     fprintf(stderr,"Number of digits reset from %s to %llu\n",
@@ -244,13 +465,14 @@ int main (int argc, char *argv[])
     digits = MAX_DIGITS;
   }
 
-  terms = digits/DIGITS_PER_ITER;
+  terms = series_terms(digits);
+  uint_select(terms);
 
   if (threads < 1 || (terms <= 0 && threads > 1)) {
     fprintf(stderr,"Number of threads reset from %d to 1\n", threads);
     threads = 1;
   }
-  else if (terms > 0 && terms < threads && threads <= ncpus) {
+  else if (terms > 0 && terms < (uint64_t) threads && threads <= ncpus) {
     fprintf(stderr,"Number of threads reset from %d to %lu\n",
       threads, (unsigned long) terms);
     threads = terms;
@@ -260,8 +482,47 @@ int main (int argc, char *argv[])
     threads = ncpus;
   }
 
-  cores_depth = 0; while ((1L << cores_depth) < threads) cores_depth++;
-  depth       = 0; while ((1L << depth) < terms) depth++;
+  /* the other phases are bandwidth bound and default to physical cores,
+     the quotient and square root run side by side */
+  ncores = physical_cores(ncpus);
+
+  if (sum_thrs < 1) sum_thrs = min(threads, ncores);
+  if (div_thrs < 1) div_thrs = min(threads, 2);
+  if (str_thrs < 1) str_thrs = min(threads, ncores);
+
+ #if !defined(_OPENMP)
+  /* only the conversion runs threads, with pthreads */
+  if (argc <= 3 || strchr(argv[3], ',') == NULL)
+    str_thrs = physical_cores((int) sysconf(_SC_NPROCESSORS_ONLN));
+ #endif
+
+  if (terms <= 0)
+    sum_thrs = div_thrs = 1;
+
+  sum_thrs = min(sum_thrs, ncpus);
+  div_thrs = min(div_thrs, 2);
+
+ #if !defined(_WIN32)
+  /* the conversion splits in two per level */
+  for (get_str_par_levels = 0; get_str_par_levels < GET_STR_PAR_LEVELS &&
+       (1 << get_str_par_levels) < str_thrs; get_str_par_levels++) ;
+ #endif
+
+  /* beyond the mpz_t limit, split into more partitions than threads */
+  pdigits = series_pi_digits(digits, terms);
+  huge = (pdigits > BIGZ_DIGITS);
+  parts = threads;
+
+  if (huge) {
+    while (pdigits / parts > BIGZ_PART_DIGITS && parts * 2 <= terms)
+      parts *= 2;
+  }
+
+  /* the sum merges the partitions, no more threads than those */
+  sum_thrs = min(sum_thrs, (int) parts);
+
+  cores_depth = 0; while ((UINT64_C(1) << cores_depth) < parts) cores_depth++;
+  depth       = 0; while ((UINT64_C(1) << depth) < terms) depth++;
 
   cores_size  = pow(2, cores_depth);
   depth++;
@@ -271,28 +532,40 @@ int main (int argc, char *argv[])
   fprintf(stderr,"# start date = %s", asctime(localtm));
   fprintf(stderr,"# terms = %lu, depth = %lu, threads = %d, logical cores = %d\n",
     (unsigned long) terms, (unsigned long) depth, threads, ncpus);
+  fprintf(stderr,"# sum threads = %d, div/sqrt = %d, str = %d, physical cores = %d\n",
+    sum_thrs, div_thrs, str_thrs, ncores);
+
+  if (series != &series_pi)
+    fprintf(stderr,"# constant = %s\n", series->name);
+
+  if (huge)
+    fprintf(stderr,"# parts = %lu, beyond mpz_t size limit\n",
+      (unsigned long) parts);
+
+ #if defined(USE_MPLIB)
+  /* calibrate up to the size of the largest product */
+  mplib_init((uint64_t) (pdigits * 3.3219280948873623 / GMP_NUMB_BITS) + 1);
+ #endif
 
  #if defined(_OPENMP)
   omp_set_dynamic(0);
  #endif
 
-  /* allocate sieve */
+  /* allocate sieve, build the first segment, the rest overlaps bs */
   wbegin = wall_clock();
 
-  if (terms > 0) {
-    sieve_size = max(3*5*23*29+1, terms*6);
-    sieve = (sieve_t *) malloc(sizeof(sieve_t)*sieve_size/2);
-    build_sieve(sieve_size, sieve);
-  }
+  if (terms > 0)
+    sieve_init(terms);
 
   wend = wall_clock();
-  display_time("sieve", wend-wbegin, wend-wbegin);
+  sieve_wall = wend-wbegin;
   wbegin = wall_clock();
 
   /* allocate stacks */
-  pstack = malloc(sizeof(mpz_t)*threads);
-  qstack = malloc(sizeof(mpz_t)*threads);
-  gstack = malloc(sizeof(mpz_t)*threads);
+  pstack = malloc(sizeof(mpz_t)*parts);
+  qstack = malloc(sizeof(mpz_t)*parts);
+  gstack = malloc(sizeof(mpz_t)*parts);
+  estack = calloc(parts, sizeof(pow2_t));
 
   mpz_init(pstack[0]);
   mpz_init(qstack[0]);
@@ -300,6 +573,8 @@ int main (int argc, char *argv[])
 
   /* begin binary splitting process */
   if (terms <= 0) {
+    display_time("sieve", sieve_wall, sieve_wall);
+
     mpz_set_ui(pstack[0],1);
     mpz_set_ui(qstack[0],0);
     mpz_set_ui(gstack[0],1);
@@ -311,9 +586,9 @@ int main (int argc, char *argv[])
     display_time("sum", 0.0, 0.0);
 
   } else {
-    mid = terms / threads; 
+    mid = terms / parts;
 
-    for (i = 1; i < threads; i++) {
+    for (i = 1; i < parts; i++) {
       mpz_init(pstack[i]);
       mpz_init(qstack[i]);
       mpz_init(gstack[i]);
@@ -321,36 +596,84 @@ int main (int argc, char *argv[])
 
     nthrs = (threads < ncpus) ? threads : ncpus;
 
+    /* one more thread builds the remaining sieve segments, bs waits
+       at the leaves until the segments it needs are published; a
+       single thread builds them first */
    #if defined(_OPENMP)
-   #pragma omp parallel for private(i) reduction(+:bs1_time) num_threads(nthrs)
+   #pragma omp parallel private(i) reduction(+:bs1_time) num_threads(nthrs > 1 ? nthrs+1 : 1)
    #endif
-    for (i = 0; i < threads; i++) {
-      double t = wall_clock();
+    {
+     #if defined(_OPENMP)
+     #pragma omp single nowait
+     #endif
+      {
+        double t = wall_clock();
+        sieve_fill();
+        fill_time = wall_clock()-t;
+      }
+
+     #if defined(_OPENMP)
+     #pragma omp for schedule(dynamic,1) nowait
+     #endif
+      for (i = 0; i < parts; i++) {
+        double t = wall_clock();
 
-      if (i < (threads-1))
-        bs_init(i*mid, (i+1)*mid, terms, cores_depth, i, depth);
-      else
-        bs_init(i*mid, terms, terms, cores_depth, i, depth);
+        if (i < (parts-1))
+          bs_init(i*mid, (i+1)*mid, terms, cores_depth, i, depth);
+        else
+          bs_init(i*mid, terms, terms, cores_depth, i, depth);
 
-      bs1_time += wall_clock()-t;
+        bs1_time += wall_clock()-t;
+      }
     }
 
     /* important, free sieve before computing sum */
-    free(sieve);
+    sieve_free();
 
     wend = wall_clock();
+    display_time("sieve", sieve_wall, sieve_wall);
+
+    /* the remaining segments, their wallclock is part of that of bs */
+    fprintf(stderr, "  %-8s  cputime = %9.2fs  within the bs wallclock\n",
+      "fill", fill_time);
+    total_cputime += fill_time;
+
     display_time("bs", bs1_time, wend-wbegin);
     wbegin = wall_clock();
 
+    /* move partitions to bigz_t, the limbs are not copied */
+    if (huge) {
+      pbigz = malloc(sizeof(bigz_t)*parts);
+      qbigz = malloc(sizeof(bigz_t)*parts);
+      gbigz = malloc(sizeof(bigz_t)*parts);
+
+      for (i = 0; i < parts; i++) {
+        pow2_apply(pstack[i], qstack[i], gstack[i], &estack[i]);
+
+        bigz_init(pbigz[i]), bigz_set_mpz(pbigz[i], pstack[i]);
+        bigz_init(qbigz[i]), bigz_set_mpz(qbigz[i], qstack[i]);
+        bigz_init(gbigz[i]), bigz_set_mpz(gbigz[i], gstack[i]);
+
+        if (i > 0) {
+          mpz_clear(pstack[i]);
+          mpz_clear(qstack[i]);
+          mpz_clear(gstack[i]);
+        }
+      }
+    }
+
    #if defined(_OPENMP)
-   #pragma omp parallel private(i,k) reduction(+:bs2_time) num_threads(nthrs)
+   #pragma omp parallel private(i,k) reduction(+:bs2_time) num_threads(sum_thrs)
     {
       for (k = 1; k < cores_size; k *= 2) {
        #pragma omp for schedule(static,1)
-        for (i = 0; i < threads; i = i+2*k) {
-          if (i+k < threads) {
-            int gflag = (i+2*k < threads) ? 1 : 0;
-            sum(i, i+k, gflag);
+        for (i = 0; i < parts; i = i+2*k) {
+          if (i+k < parts) {
+            int gflag = (i+2*k < parts) ? 1 : 0;
+            if (huge)
+              sum_bigz(i, i+k, gflag);
+            else
+              sum(i, i+k, gflag);
           }
         }
        #pragma omp barrier
@@ -358,10 +681,13 @@ int main (int argc, char *argv[])
     }
    #else
     for (k = 1; k < cores_size; k *= 2) {
-      for (i = 0; i < threads; i = i+2*k) {
-        if (i+k < threads) {
-          int gflag = (i+2*k < threads) ? 1 : 0;
-          sum(i, i+k, gflag);
+      for (i = 0; i < parts; i = i+2*k) {
+        if (i+k < parts) {
+          int gflag = (i+2*k < parts) ? 1 : 0;
+          if (huge)
+            sum_bigz(i, i+k, gflag);
+          else
+            sum(i, i+k, gflag);
         }
       }
     }
@@ -371,67 +697,117 @@ int main (int argc, char *argv[])
     display_time("sum", bs2_time, wend-wbegin);
   }
 
+  if (!huge)
+    pow2_apply(pstack[0], qstack[0], gstack[0], &estack[0]);
+
   mpz_clear(gstack[0]); free(gstack);
+  free(estack);
 
-  /* prepare to convert integers to floats */
-  mpf_set_default_prec((mp_bitcnt_t)(digits * BITS_PER_DIGIT + 16));
+  if (huge) {
+    /* same as below, in fixed point with n limbs after the radix point */
+    n = (mp_size_t) ((digits + 16) * BITS_PER_DIGIT / GMP_NUMB_BITS) + 2;
 
-  /*
-	  p*(C/D)*sqrt(C)
-    pi = -----------------
-	     (q+A*p)
-  */
-  psize = mpz_sizeinbase(pstack[0],10);
-  qsize = mpz_sizeinbase(qstack[0],10);
+    bigz_clear(gbigz[0]); free(gbigz);
+    mpz_clear(pstack[0]); free(pstack);
+    mpz_clear(qstack[0]); free(qstack);
 
-  mpz_addmul_ui(qstack[0], pstack[0], A);
-  mpz_mul_ui(pstack[0], pstack[0], C/D);
+    psize = bigz_sizeinbase10(pbigz[0]);
+    qsize = bigz_sizeinbase10(qbigz[0]);
 
-  mpf_init(pi), mpf_set_z(pi, pstack[0]);
-  mpz_clear(pstack[0]);
-  free(pstack);
+    bigz_addmul_ui(qbigz[0], pbigz[0], series->a0);
 
-  mpf_init(qi), mpf_set_z(qi, qstack[0]);
-  mpz_clear(qstack[0]);
-  free(qstack);
+    if (!series->inverse) {
+      bigz_struct t = *pbigz[0]; *pbigz[0] = *qbigz[0], *qbigz[0] = t;
+    }
+    if (series->mul > 1)
+      bigz_mul_ui(pbigz[0], pbigz[0], series->mul);
+    if (series->div > 1)
+      bigz_mul_ui(qbigz[0], qbigz[0], series->div);
 
-  /* final step */
+    bigz_init(qz);
+    final_bigz(qz, n, div_thrs);
+  }
+  else {
+    /* prepare to convert integers to floats */
+    mpf_set_default_prec((mp_bitcnt_t)(digits * BITS_PER_DIGIT + 16));
+
+    /*
+	    p*(C/D)*sqrt(C)
+      pi = -----------------
+	       (q+A*p)
+
+      other series, see pgmp-series.h
+    */
+    psize = mpz_sizeinbase(pstack[0],10);
+    qsize = mpz_sizeinbase(qstack[0],10);
+
+    mpz_addmul_ui(qstack[0], pstack[0], series->a0);
+
+    if (!series->inverse)
+      mpz_swap(pstack[0], qstack[0]);
+    if (series->mul > 1)
+      mpz_mul_ui(pstack[0], pstack[0], series->mul);
+    if (series->div > 1)
+      mpz_mul_ui(qstack[0], qstack[0], series->div);
+
+   #if defined(USE_DECIMAL)
+    mpz_init_set(dec_num, pstack[0]);
+    mpz_init_set(dec_den, qstack[0]);
+    bin_time = total_wallclock;
+   #endif
 
-  wbegin = wall_clock();
-  nthrs = (threads > 1) ? 2 : 1;
+    mpf_init(pi), mpf_set_z(pi, pstack[0]);
+    mpz_clear(pstack[0]);
+    free(pstack);
 
- #if defined(_OPENMP)
- #pragma omp parallel shared(qi,pi,ci) reduction(+:div_time) num_threads(nthrs)
-  {
- #endif
-    int tid = omp_get_thread_num();
+    mpf_init(qi), mpf_set_z(qi, qstack[0]);
+    mpz_clear(qstack[0]);
+    free(qstack);
 
-    if (tid == 0) {
-      double t = wall_clock();
-      my_div(qi, pi, qi);
-      mpf_clear(pi);
-      div_time += wall_clock()-t;
-    }
-    if (tid == 1 || omp_get_num_threads() < 2) {
-      double t = wall_clock();
-      mpf_init(ci);
-      my_sqrt_ui(ci, C);
-      div_time += wall_clock()-t;
+    /* final step */
+
+    wbegin = wall_clock();
+
+  #if defined(_OPENMP)
+  #pragma omp parallel shared(qi,pi,ci) reduction(+:div_time) num_threads(div_thrs)
+    {
+  #endif
+      int tid = omp_get_thread_num();
+
+      if (tid == 0) {
+        double t = wall_clock();
+        my_div(qi, pi, qi);
+        mpf_clear(pi);
+        div_time += wall_clock()-t;
+      }
+      if ((tid == 1 || omp_get_num_threads() < 2) && series->root > 1) {
+        double t = wall_clock();
+        mpf_init(ci);
+        my_sqrt_ui(ci, series->root);
+        div_time += wall_clock()-t;
+      }
+
+  #if defined(_OPENMP)
     }
+  #endif
 
- #if defined(_OPENMP)
-  }
- #endif
+    wend = wall_clock();
+    display_time("div/sqrt", div_time, wend-wbegin);
+    wbegin = wall_clock();
 
-  wend = wall_clock();
-  display_time("div/sqrt", div_time, wend-wbegin);
-  wbegin = wall_clock();
+    if (series->root > 1) {
+      mpf_mul(qi, qi, ci);
+      mpf_clear(ci);
+    }
+
+    wend = wall_clock();
+    display_time("mul", wend-wbegin, wend-wbegin);
 
-  mpf_mul(qi, qi, ci);
-  mpf_clear(ci);
+   #if defined(USE_DECIMAL)
+    bin_time = total_wallclock - bin_time;
+   #endif
+  }
 
-  wend = wall_clock();
-  display_time("mul", wend-wbegin, wend-wbegin);
   display_time("total", total_cputime, total_wallclock);
 
   fprintf(stderr,
@@ -447,24 +823,60 @@ int main (int argc, char *argv[])
 
   /* output Pi */
 
-  if (out == 1) {
-    mp_exp_t exp = 0; int i;
-    char *str = malloc(digits+16+2);
+ #if defined(USE_DECIMAL)
+  if (!huge) {
+    /* compare against the decimal final step on the same inputs */
+    double t = wall_clock();
+    str = mpf_get_digits(qi, digits);
+    bin_time += wall_clock()-t;
+
+    dec_nthrs = min(threads, 3);
+    dec_compare(dec_num, dec_den, series->root, digits, str, bin_time);
+    mpz_clear(dec_num), mpz_clear(dec_den);
+  }
+  else
+ #endif
+  str = ((out >= 1 && out <= 14) || nsinks > 0)
+    ? (huge ? bigz_fix_get_str(qz, n, digits) : mpf_get_digits(qi, digits))
+    : NULL;
 
-    mpf_get_str(&(str[1]), &exp, 10, digits+16, qi);
-    for (i = 0; i < exp; i++) str[i] = str[i+1];
+  if (huge)
+    bigz_clear(qz);
+  else
+    mpf_clear(qi);
 
-    str[exp] = '.', str[digits+2] = 0;
-    fwrite(str, sizeof(char), digits+2, stdout), fflush(stdout);
-    fprintf(stderr, "\n"), fflush(stderr);
+  if (nsinks > 0) {
+    spliced = sinks_run(str, digits);
+  }
+  else if (out == 1) {
+    uint64_t len = strlen(str);
+    double t = wall_clock();
 
-    free((void *) str);
+    spliced = output_raw(stdout, str, len);
+    t = wall_clock()-t;
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "# stdout = %.2fs, %.0f MB/s, %s\n", t, len / max(t, 1e-6) / 1e6,
+      spliced > 0 ? "vmsplice" : spliced < 0 ? "failed" : "write");
+    fflush(stderr);
   }
   else if (out >= 2 && out <= 14) {
-    output_digits(qi, digits, out);
+    output_digits(str, digits, out);
+  }
+
+  /* spliced pages may still wait in the pipe, exit releases them */
+  if (str != NULL && spliced <= 0)
+    free((void *) str);
+
+ #if !defined(_WIN32)
+  if (budget > 0.0 && !budget_child) {
+    double actual = wall_clock()-run_begin;
+    fprintf(stderr,"# time budget = %.1fs, predicted = %.1fs, actual = %.1fs (%+.1f%%), with calibration = %.1fs\n",
+      budget, budget_compute + budget_output, actual,
+      100.0 * (actual / (budget_compute + budget_output) - 1.0), actual + budget_cal);
   }
+ #endif
 
-  mpf_clear(qi);
   exit (0);
 }
 
@@ -39,6 +39,10 @@
 #ifndef PGMP_CHUDNOVSKY_H
 #define PGMP_CHUDNOVSKY_H
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // vmsplice, see pgmp-sink.h
+#endif
+
 #include <math.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -47,11 +51,16 @@
 #include <locale.h>
 #include <unistd.h>
 #include <time.h>
+#include <sched.h>
 
 #if !defined(_WIN32)
 #include <sys/time.h>
 #endif
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 #if defined(_WIN32)
 #define strtoull _strtoui64
 #endif
@@ -91,6 +100,9 @@
 #define C  640320
 #define D  12
 
+#define min(x,y) ((x)<(y)?(x):(y))
+#define max(x,y) ((x)>(y)?(x):(y))
+
 ////////////////////////////////////////////////////////////////////////////
 
 // clock_gettime isn't available on some platforms, e.g. Darwin
@@ -119,16 +131,49 @@ double wall_clock ()
 #endif
 }
 
+// Physical cores behind ncpus logical cores, from the SMT siblings listed
+// in sysfs. Returns ncpus when the topology is not available.
+
+int physical_cores (int ncpus)
+{
+#if defined(__linux__)
+  char path[96];
+  long cpu, ncpu = sysconf(_SC_NPROCESSORS_CONF);
+  int  first, cpus = 0, cores = 0;
+  FILE *fp;
+
+  for (cpu = 0; cpu < ncpu; cpu++) {
+    sprintf(path, "/sys/devices/system/cpu/cpu%ld/topology/thread_siblings_list", cpu);
+
+    if ((fp = fopen(path, "r")) == NULL)
+      continue;
+
+    /* the first sibling stands for the core */
+    if (fscanf(fp, "%d", &first) == 1) {
+      cpus++;
+      if (first == cpu) cores++;
+    }
+    fclose(fp);
+  }
+
+  /* scale down to the cores available to us */
+  if (cpus > 0 && cores > 0)
+    return max(1, (int) ((int64_t) ncpus * cores / cpus));
+#endif
+
+  return ncpus;
+}
+
 // For formatting comma-separated numbers, using the locale's thousands
 // separator, if available. See http://c-faq.com/stdio/commaprint.html.
+// retbuf holds __MAXDIGITS chars.
 
 #define __MAXDIGITS (sizeof(int64_t) * 8 * sizeof(char) / 3) + 2
 
-char *commify (uint64_t n)
+char *commify_r (uint64_t n, char *retbuf)
 {
   static int comma = '\0';
-  static char retbuf[__MAXDIGITS];
-  char *p = &retbuf[sizeof(retbuf)-1];
+  char *p = &retbuf[__MAXDIGITS-1];
   int  i = 0;
 
   if (comma == '\0') {
@@ -152,27 +197,54 @@ char *commify (uint64_t n)
   return p;
 }
 
-// Display digits to standard output with spacing.
+// As commify_r, into a static buffer, not thread safe.
 
-void output_digits (mpf_t pi, uint64_t digits, int columns)
+char *commify (uint64_t n)
 {
-  if (columns < 1) return;
+  static char retbuf[__MAXDIGITS];
+  return commify_r(n, retbuf);
+}
+
+// Digits of x as "I.DDD...D" with digits after the point, truncated.
 
+char *mpf_get_digits (mpf_t x, uint64_t digits)
+{
   mp_exp_t exp = 0;
+  char *str = malloc(digits+16+2);
+  int  i;
+
+  mpf_get_str(&(str[1]), &exp, 10, digits+16, x);
+
+  if (exp > 0) {
+    for (i = 0; i < exp; i++) str[i] = str[i+1];
+    str[exp] = '.', str[exp+digits+1] = 0;
+  }
+  else {
+    /* 0.000ddd for x < 1 */
+    int64_t len = min((int64_t) strlen(&(str[1])), (int64_t) digits + exp);
+    if (len > 0) memmove(&(str[2-exp]), &(str[1]), len);
+    memset(&(str[2]), '0', min((uint64_t) -exp, digits));
+    str[0] = '0', str[1] = '.', str[digits+2] = 0;
+  }
+
+  return str;
+}
+
+// Write digits to fp with spacing, returns 1 when the last line is full.
+
+int output_digits_fp (FILE *fp, char *str, uint64_t digits, int columns)
+{
+  if (columns < 1) return 1;
+
   uint64_t acc = 0;
-  char *p, *str = malloc(digits+16+2);
-  char *b, *buf = malloc(columns*11+1);
+  char *p = strchr(str, '.');
+  char *b, *buf = malloc(columns*11+1), num[__MAXDIGITS];
   int  acc_width, i, j, k, flag = 0, max = columns*10;
 
-  snprintf(buf, __MAXDIGITS-1, "%s", commify(digits));
-  acc_width = strlen(buf);
-
-  mpf_get_str(&(str[1]), &exp, 10, digits+16, pi);
-  for (i = 0; i < exp; i++) str[i] = str[i+1];
+  acc_width = strlen(commify_r(digits, num));
 
-  str[exp] = '.', str[digits+2] = 0;
-  b = buf, p = str, p += 2, i = j = 0;
-  printf("3.");
+  b = buf, p++, i = j = 0;
+  fprintf(fp, "%.*s", (int) (p-str), str);
 
   while (*p) {
     *b++ = *p++;
@@ -182,9 +254,9 @@ void output_digits (mpf_t pi, uint64_t digits, int columns)
 
       if (i % max == 0) {
         *b = 0, acc += max;
-        printf("%s :  %*s\n", buf, acc_width, commify(acc));
-        if (++j % 10 == 0) { printf("\n"), j = 0; }
-        if (*p) printf("  ");
+        fprintf(fp, "%s :  %*s\n", buf, acc_width, commify_r(acc, num));
+        if (++j % 10 == 0) { fprintf(fp, "\n"), j = 0; }
+        if (*p) fprintf(fp, "  ");
 
         b = buf, flag = 1, i = 0;
       }
@@ -195,271 +267,396 @@ void output_digits (mpf_t pi, uint64_t digits, int columns)
     if (flag) {
       for (k = 10; k < max; k += 10) { if (i < k) *b++ = ' '; }
       *b = 0, acc += i;
-      printf("%s %*s :  %*s\n", buf, max-i, "", acc_width, commify(acc));
+      fprintf(fp, "%s %*s :  %*s\n", buf, max-i, "", acc_width, commify_r(acc, num));
     }
     else {
       if (i == 0 || i % 10 != 0) *b++ = ' ';
       *b = 0, acc += i;
-      printf("%s :  %*s\n", buf, acc_width, commify(acc));
+      fprintf(fp, "%s :  %*s\n", buf, acc_width, commify_r(acc, num));
     }
   }
 
-  fflush(stdout);
+  fflush(fp);
+  free((void *) buf);
 
-  if (!flag || j != 0)
-    fprintf(stderr, "\n"), fflush(stderr);
+  return (flag && j == 0);
+}
 
-  free((void *) buf);
-  free((void *) str);
+// Display digits to standard output with spacing.
+
+void output_digits (char *str, uint64_t digits, int columns)
+{
+  if (!output_digits_fp(stdout, str, digits, columns))
+    fprintf(stderr, "\n"), fflush(stderr);
 }
 
 ////////////////////////////////////////////////////////////////////////////
 
-// sieve_t limit using uint64_t (-DBIG_SIEVE=1), default uint32_t
+// Index width is chosen at runtime from the sieve size.
 //
 // GMP has a limit of 41 billion digits to not overflow mpz_t.
-// The (uint32_t) sieve accomodates 10,151,618,680 digits max.
+// Beyond BIGZ_DIGITS, the root P and Q are combined and finished
+// as bigz_t (see pgmp-bigz.h), with bs() partitions limited to
+// BIGZ_PART_DIGITS each so that every partition fits mpz_t.
+// Both limits are in digits of pi; other series are compared by
+// the estimated size of P, see series_pi_digits.
+// The (uint32_t) sieve accomodates 10,151,618,680 digits max,
+// beyond that the (uint64_t) sieve and fac_t are used, which
+// consume twice the memory.
 // On 32-bit HW, limit digits to consume less than 3.5 GiB.
 
-#define min(x,y) ((x)<(y)?(x):(y))
-#define max(x,y) ((x)>(y)?(x):(y))
-
 #if __LP64__
- #if BIG_SIEVE
-  static const uint64_t MAX_DIGITS = UINT64_C(40000000000);
-  typedef uint64_t uint_t;
- #else
-  static const uint64_t MAX_DIGITS = UINT64_C(10000000000);
-  typedef uint32_t uint_t;
- #endif
+  static const uint64_t MAX_DIGITS = UINT64_C(1000000000000);
 #else
  #if defined(_WIN64)
   static const uint64_t MAX_DIGITS = UINT64_C(640000000);
-  typedef uint32_t uint_t;
  #else
   static const uint64_t MAX_DIGITS = UINT64_C(120000000);
-  typedef uint32_t uint_t;
  #endif
 #endif
 
-typedef struct {
-  uint_t max_facs;
-  uint_t num_facs;
-  uint_t *fac;
-  uint_t *pow;
-} fac_t[1];
+static const uint64_t MAX_DIGITS_32 = UINT64_C(10000000000);
 
-typedef struct {
-  uint_t fac;
-  uint_t pow;
-  uint_t nxt;
-} sieve_t;
-
-sieve_t *sieve;
-uint_t  sieve_size;
+#ifndef BIGZ_DIGITS
+#define BIGZ_DIGITS       UINT64_C(25000000000)
+#endif
+#ifndef BIGZ_PART_DIGITS
+#define BIGZ_PART_DIGITS  UINT64_C(10000000000)
+#endif
 
 #define INIT_FACS 32
 
-void fac_reset (fac_t f)
+/* numbers per sieve segment, bs starts on the first one, see sieve_fill */
+#ifndef SIEVE_SEGMENT
+#define SIEVE_SEGMENT  (1 << 20)
+#endif
+
+/* large products in bs and sum, see pgmp-mplib.h */
+
+#if defined(USE_MPLIB)
+ #include "pgmp-mplib.h"
+ #define my_mul mplib_mul
+#else
+ #define my_mul mpz_mul
+#endif
+
+////////////////////////////////////////////////////////////////////////////
+
+// Exact division by the gcd in fac_remove_gcd.
+//
+// With OpenMP, p/d and g/d run as two tasks, which threads done with
+// their own bs partition pick up. In a team of two or more threads, a
+// quotient of DIVEXACT_SPLIT limbs or more is split once more into two
+// tasks: the high part by truncating division of the top of n, the low
+// m bits by Hensel division, i.e. n times the inverse of d modulo 2^m.
+// The low part costs more per limb, so it takes the smaller share. The
+// split adds work; it shortens the critical path by about a quarter.
+
+#define DIVEXACT_TASK   4096            /* limbs, tuning parameter */
+#define DIVEXACT_SPLIT  262144          /* limbs, tuning parameter */
+#define DIVEXACT_LOW    0.3             /* share of the low part */
+
+/* r = 1/d mod 2^m for odd d, by Newton's iteration */
+void binvert_2exp (mpz_t r, mpz_t d, mp_bitcnt_t m)
 {
-  f[0].num_facs = 0;
+  uint64_t d0 = 0, x;
+  mp_bitcnt_t k = 64;
+  mpz_t t;
+  int i;
+
+  /* the low 64 bits of d, whatever the limb size */
+  mpz_init(t);
+  mpz_fdiv_r_2exp(t, d, 64);
+  mpz_export(&d0, NULL, -1, sizeof(d0), 0, 0, t);
+  x = d0;
+
+  for (i = 0; i < 5; i++)               /* 3, 6, 12, 24, 48, 96 bits */
+    x *= 2 - d0 * x;
+
+  mpz_import(r, 1, -1, sizeof(x), 0, 0, &x);
+
+  while (k < m) {
+    k = min(2*k, m);
+    mpz_fdiv_r_2exp(t, d, k);
+    mpz_mul(t, t, r);
+    mpz_fdiv_r_2exp(t, t, k);
+    mpz_ui_sub(t, 2, t);
+    mpz_mul(r, r, t);
+    mpz_fdiv_r_2exp(r, r, k);
+  }
+
+  mpz_fdiv_r_2exp(r, r, m);
+  mpz_clear(t);
 }
 
-void fac_init_size (fac_t f, uint_t s)
+/* q = n/d, d divides n */
+void divexact (mpz_t q, mpz_t n, mpz_t d)
 {
-  if (s < INIT_FACS)
-    s = INIT_FACS;
+ #if defined(_OPENMP)
+  mp_size_t qn = (mp_size_t) mpz_size(n) - (mp_size_t) mpz_size(d) + 1;
+  mp_bitcnt_t m;
+  mpz_t hi, lo;
+
+  if (qn < DIVEXACT_SPLIT || omp_get_num_threads() < 2 ||
+      mpz_sgn(n) <= 0 || mpz_sgn(d) <= 0 || mpz_even_p(d)) {
+    mpz_divexact(q, n, d);
+    return;
+  }
+
+  m = (mp_bitcnt_t) (qn * DIVEXACT_LOW) * GMP_NUMB_BITS;
+  mpz_init(hi), mpz_init(lo);
+
+  #pragma omp task shared(hi)
+  {
+    mpz_tdiv_q_2exp(hi, n, m);
+    mpz_tdiv_q(hi, hi, d);
+  }
+  #pragma omp task shared(lo)
+  {
+    mpz_t inv;
+    mpz_init(inv);
+    binvert_2exp(inv, d, m);
+    mpz_fdiv_r_2exp(lo, n, m);
+    mpz_mul(lo, lo, inv);
+    mpz_fdiv_r_2exp(lo, lo, m);
+    mpz_clear(inv);
+  }
+  #pragma omp taskwait
 
-  f[0].fac = malloc(s*sizeof(uint_t)*2);
-  f[0].pow = f[0].fac + s;
-  f[0].max_facs = s;
+  mpz_mul_2exp(hi, hi, m);
+  mpz_add(q, hi, lo);
 
-  fac_reset(f);
+  mpz_clear(hi), mpz_clear(lo);
+ #else
+  mpz_divexact(q, n, d);
+ #endif
 }
 
-void fac_init (fac_t f)
+/* p = p/d, g = g/d, d divides both */
+void divexact2 (mpz_t p, mpz_t g, mpz_t d)
 {
-  fac_init_size(f, INIT_FACS);
+ #if defined(_OPENMP)
+  if (mpz_size(p) + mpz_size(g) >= DIVEXACT_TASK) {
+    #pragma omp task
+    divexact(p, p, d);
+    #pragma omp task
+    divexact(g, g, d);
+    #pragma omp taskwait
+    return;
+  }
+ #endif
+
+  mpz_divexact(p, p, d);
+  mpz_divexact(g, g, d);
 }
 
-void fac_clear (fac_t f)
+/*
+  Powers of two in p, q, and g are kept apart from the values as
+  exponents, so bs and sum multiply odd numbers. C^3/24 alone puts 15
+  bits per term into P. A shift replaces the multiplication by 2^e,
+  and pow2_apply restores the value at the end.
+*/
+typedef struct {
+  uint64_t p, q, g;
+} pow2_t;
+
+/* x = x/2^e for the largest such e, returns e */
+uint64_t pow2_strip (mpz_t x)
 {
-  free(f[0].fac);
+  uint64_t e;
+
+  if (mpz_sgn(x) == 0)
+    return 0;
+
+  e = mpz_scan1(x, 0);
+  mpz_tdiv_q_2exp(x, x, e);
+
+  return e;
 }
 
-void fac_resize (fac_t f, uint_t s)
+/* r*2^er = r*2^er + x*2^ex, shifting the term with the larger exponent */
+void pow2_add (mpz_t r, uint64_t *er, mpz_t x, uint64_t ex)
 {
-  if (f[0].max_facs < s) {
-    fac_clear(f);
-    fac_init_size(f, s);
+  if (*er > ex) {
+    mpz_mul_2exp(r, r, *er - ex);
+    *er = ex;
+  }
+  else if (ex > *er) {
+    mpz_mul_2exp(x, x, ex - *er);
   }
+
+  mpz_add(r, r, x);
 }
 
-/* f = base^pow */
-void fac_set_bp (fac_t f, uint_t base, uint_t pow)
+void pow2_apply (mpz_t p, mpz_t q, mpz_t g, pow2_t *e)
 {
-  uint_t i;
+  mpz_mul_2exp(p, p, e->p);
+  mpz_mul_2exp(q, q, e->q);
+  mpz_mul_2exp(g, g, e->g);
 
-  for (i=0, base/=2; base>0; i++, base = sieve[base].nxt) {
-    f[0].fac[i] = sieve[base].fac;
-    f[0].pow[i] = sieve[base].pow*pow;
-  }
+  e->p = e->q = e->g = 0;
+}
+
+#include "pgmp-series.h"
+
+////////////////////////////////////////////////////////////////////////////
 
-  f[0].num_facs = i;
+// Operands of bs.
+//
+// A node of bs whose p, q, and g are estimated below BS_STACK_LIMBS in
+// all is computed on a per-thread stack of limbs: the outputs of both
+// halves and the scratch of the merge are carved from it at the sizes
+// given by bs_size, and released on return. Every product goes to a
+// destination apart from its sources, sized so that GMP never reallocs
+// it. Above BS_STACK_LIMBS, the products go to fresh destinations sized
+// to the product and the following shift and add, and are swapped in.
+
+#ifndef BS_STACK_LIMBS
+#define BS_STACK_LIMBS  16384           /* tuning parameter */
+#endif
+
+typedef struct {
+  mp_limb_t *d;
+  size_t top, size;
+  mpz_t p, q, g;                        /* scratch for the terms */
+} bs_stack_t;
+
+/* ceil(log2(x)) */
+int log2_ceil (uint64_t x)
+{
+  return (x > 1) ? 64 - __builtin_clzll(x - 1) : 0;
 }
 
-/* r = f*g */
-void fac_mul2 (fac_t r, fac_t f, fac_t g)
+/*
+  limbs for p, q, and g over (a,b], from the bits of the largest term:
+  |p| <= prod p(k), |g| <= prod g(k), and as q(a,b) sums b-a products
+  of all p(k) or g(k) but one, and a q(k), |q| <= (b-a) prod max(p(k),
+  g(k)) max q(k)/g(k). Dividing out the gcd and the powers of two keeps
+  the bounds. Three limbs more leave room for the products and adds of
+  bs, which GMP sizes by the operands.
+*/
+void bs_size (uint64_t a, uint64_t b, mp_size_t *pn, mp_size_t *qn, mp_size_t *gn)
 {
-  uint_t i, j, k;
-
-  for (i=j=k=0; i<f[0].num_facs && j<g[0].num_facs; k++) {
-    if (f[0].fac[i] == g[0].fac[j]) {
-      r[0].fac[k] = f[0].fac[i];
-      r[0].pow[k] = f[0].pow[i] + g[0].pow[j];
-      i++; j++;
-    } else if (f[0].fac[i] < g[0].fac[j]) {
-      r[0].fac[k] = f[0].fac[i];
-      r[0].pow[k] = f[0].pow[i];
-      i++;
-    } else {
-      r[0].fac[k] = g[0].fac[j];
-      r[0].pow[k] = g[0].pow[j];
-      j++;
-    }
-  }
-  for (; i<f[0].num_facs; i++, k++) {
-    r[0].fac[k] = f[0].fac[i];
-    r[0].pow[k] = f[0].pow[i];
-  }
-  for (; j<g[0].num_facs; j++, k++) {
-    r[0].fac[k] = g[0].fac[j];
-    r[0].pow[k] = g[0].pow[j];
-  }
+  uint64_t n = b - a, *t = series_bits[log2_ceil(b)];
 
-  r[0].num_facs = k;
+  *pn = (mp_size_t) (n * t[0] / GMP_NUMB_BITS) + 3;
+  *gn = (mp_size_t) (n * t[1] / GMP_NUMB_BITS) + 3;
+  *qn = (mp_size_t) ((n * max(t[0], t[1]) + t[2] + log2_ceil(n)) / GMP_NUMB_BITS) + 3;
 }
 
-/* f *= g */
-void fac_mul (fac_t f, fac_t g, fac_t fmul)
+/*
+  a node holds its outputs and, below them, at most the sizes of its
+  halves plus the merge scratch; as a half is at most 2/3 of its node,
+  a subtree of n limbs needs less than 3n plus a few limbs per level
+*/
+void bs_stack_init (bs_stack_t *s, mp_size_t n)
 {
-  fac_t tmp;
-  fac_resize(fmul, f[0].num_facs + g[0].num_facs);
-  fac_mul2(fmul, f, g);
-  tmp[0]  = f[0];
-  f[0]    = fmul[0];
-  fmul[0] = tmp[0];
+  s->size = 3 * (size_t) min(n, BS_STACK_LIMBS) + 2048;
+  s->d = malloc(sizeof(mp_limb_t) * s->size);
+  s->top = 0;
+  mpz_init(s->p), mpz_init(s->q), mpz_init(s->g);
 }
 
-/* f *= base^pow */
-void fac_mul_bp (fac_t f, uint_t base, uint_t pow, fac_t ftmp, fac_t fmul)
+void bs_stack_clear (bs_stack_t *s)
 {
-  fac_set_bp(ftmp, base, pow);
-  fac_mul(f, ftmp, fmul);
+  free(s->d);
+  mpz_clear(s->p), mpz_clear(s->q), mpz_clear(s->g);
 }
 
-/* remove factors of power 0 */
-void fac_compact (fac_t f)
+/* z = 0 in n limbs on top of the stack, released by restoring s->top */
+void bs_stack_mpz (bs_stack_t *s, mpz_t z, mp_size_t n)
 {
-  uint_t i, j;
-
-  for (i=0, j=0; i<f[0].num_facs; i++) {
-    if (f[0].pow[i]>0) {
-      if (j<i) {
-        f[0].fac[j] = f[0].fac[i];
-        f[0].pow[j] = f[0].pow[i];
-      }
-      j++;
-    }
+  if (s->top + n > s->size) {
+    fprintf(stderr, "bs stack overflow (%lu + %ld > %lu limbs)\n",
+      (unsigned long) s->top, (long) n, (unsigned long) s->size);
+    abort();
   }
 
-  f[0].num_facs = j;
+  z->_mp_d = s->d + s->top;
+  z->_mp_alloc = (int) n;
+  z->_mp_size = 0;
+  s->top += n;
 }
 
-/* convert factorized form to number */
-void bs_mul (mpz_t r, uint_t a, uint_t b, fac_t fmul)
+/*
+  r = a*b, for r aliasing a or b. The product goes to a fresh destination
+  of n limbs, n >= |a|+|b|, which is swapped into r.
+*/
+void mul_swap (mpz_t r, mpz_t a, mpz_t b, mp_size_t n)
 {
-  uint_t i, j;
-
-  if (b-a<=32) {
-    mpz_set_ui(r, 1);
-    for (i=a; i<b; i++)
-      for (j=0; j<fmul[0].pow[i]; j++)
-        mpz_mul_ui(r, r, fmul[0].fac[i]);
-  } else {
-    mpz_t r2;
-    mpz_init(r2);
-    bs_mul(r2, a, (a+b)/2, fmul);
-    bs_mul(r, (a+b)/2, b, fmul);
-    mpz_mul(r, r, r2);
-    mpz_clear(r2);
-  }
+  mpz_t t;
+
+  mpz_init2(t, (mp_bitcnt_t) n * GMP_NUMB_BITS);
+  my_mul(t, a, b);
+  mpz_swap(r, t);
+  mpz_clear(t);
 }
 
-/* f /= gcd(f,g), g /= gcd(f,g) */
-void fac_remove_gcd (mpz_t p, fac_t fp, mpz_t g, fac_t fg, mpz_t gcd, fac_t fmul)
+/*
+  limbs for r*2^er + x*2^ex after pow2_add, r = r1*r2 and x = x1*x2,
+  so that neither product is regrown by the shift or the add
+*/
+mp_size_t pow2_add_size (mpz_t r1, mpz_t r2, uint64_t er, mpz_t x1, mpz_t x2, uint64_t ex)
 {
-  uint_t i, j, k, c;
-
-  fac_resize(fmul, min(fp->num_facs, fg->num_facs));
-
-  for (i=j=k=0; i<fp->num_facs && j<fg->num_facs; ) {
-    if (fp->fac[i] == fg->fac[j]) {
-      c = min(fp->pow[i], fg->pow[j]);
-      fp->pow[i] -= c;
-      fg->pow[j] -= c;
-      fmul->fac[k] = fp->fac[i];
-      fmul->pow[k] = c;
-      i++; j++; k++;
-    } else if (fp->fac[i] < fg->fac[j]) {
-      i++;
-    } else {
-      j++;
-    }
-  }
+  mp_size_t rn = mpz_size(r1) + mpz_size(r2), xn = mpz_size(x1) + mpz_size(x2);
+  uint64_t d = (er > ex) ? er - ex : ex - er;
 
-  fmul->num_facs = k;
+  return max(rn, xn) + (mp_size_t) (d / GMP_NUMB_BITS) + 2;
+}
 
-  if (fmul->num_facs) {
-    bs_mul(gcd, 0, fmul->num_facs, fmul);
-    mpz_divexact(p, p, gcd);
-    mpz_divexact(g, g, gcd);
-    fac_compact(fp);
-    fac_compact(fg);
-  }
+#define uint_t  uint32_t
+#define W(name) name##_32
+#include "pgmp-bs.h"
+#undef  uint_t
+#undef  W
+
+#define uint_t  uint64_t
+#define W(name) name##_64
+#include "pgmp-bs.h"
+#undef  uint_t
+#undef  W
+
+int uint_bits = 32;
+
+/* select the index width from the sieve size, call before sieve_init */
+void uint_select (uint64_t terms)
+{
+  uint64_t n = max(series->sieve_min, terms*series->sieve_mul);
+  uint_bits = (n > (uint64_t) (MAX_DIGITS_32/DIGITS_PER_ITER) * 6) ? 64 : 32;
 }
 
-void build_sieve(uint_t n, sieve_t *s)
+void sieve_init (uint64_t terms)
 {
-  uint_t m, i, j, k;
-
-  sieve_size = n;
-  m = (uint_t) sqrt(n);
-  memset(s, 0, sizeof(sieve_t)*n/2);
-
-  s[1/2].fac = 1;
-  s[1/2].pow = 1;
-
-  for (i=3; i<=n; i+=2) {
-    if (s[i/2].fac == 0) {
-      s[i/2].fac = i;
-      s[i/2].pow = 1;
-      if (i<=m) {
-        for (j=i*i, k=i/2; j<=n; j+=i+i, k++) {
-          if (s[j/2].fac==0) {
-            s[j/2].fac = i;
-            if (s[k].fac == i) {
-              s[j/2].pow = s[k].pow + 1;
-              s[j/2].nxt = s[k].nxt;
-            } else {
-              s[j/2].pow = 1;
-              s[j/2].nxt = k;
-            }
-          }
-        }
-      }
-    }
-  }
+  series_bits_init(terms);
+
+  if (uint_bits == 32)
+    sieve_init_32(terms);
+  else
+    sieve_init_64(terms);
+}
+
+void sieve_fill ()
+{
+  if (uint_bits == 32)
+    sieve_fill_32();
+  else
+    sieve_fill_64();
+}
+
+void sieve_free ()
+{
+  if (uint_bits == 32)
+    sieve_free_32();
+  else
+    sieve_free_64();
+}
+
+void bs_range (mpz_t p1, mpz_t q1, mpz_t g1, uint64_t a, uint64_t b, uint64_t terms, uint64_t level, uint64_t depth, pow2_t *e1)
+{
+  if (uint_bits == 32)
+    bs_range_32(p1, q1, g1, a, b, terms, level, depth, e1);
+  else
+    bs_range_64(p1, q1, g1, a, b, terms, level, depth, e1);
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -581,99 +778,5 @@ void my_div (mpf_t r, mpf_t y, mpf_t x)
 }
 #endif
 
-////////////////////////////////////////////////////////////////////////////
-
-// binary splitting
-
-typedef struct {
-  mpz_t p, q, g;
-  fac_t fp, fg;
-  int cleared;
-} tmp_t;
-
-#define  pj tmp[j].p
-#define  qj tmp[j].q
-#define  gj tmp[j].g
-#define fpj tmp[j].fp
-#define fgj tmp[j].fg
-
-void bs (mpz_t p1, mpz_t q1, mpz_t g1, fac_t fp1, fac_t fg1, uint_t a, uint_t b, uint_t terms, uint_t level, mpz_t gcd, fac_t ftmp, fac_t fmul, tmp_t *tmp, uint_t j, int clear_flag)
-{
-  uint_t i, mid;
-
-  if (b-a == 1) {
-    /*
-      g(b-1,b) = (6b-5)(2b-1)(6b-1)
-      p(b-1,b) = b^3 * C^3 / 24
-      q(b-1,b) = (-1)^b*g(b-1,b)*(A+Bb).
-    */
-    mpz_set_ui(p1, b);
-    mpz_mul_ui(p1, p1, b);
-    mpz_mul_ui(p1, p1, b);
-    mpz_mul_ui(p1, p1, (C/24) * (C/24));
-    mpz_mul_ui(p1, p1, (C*24));
-
-    mpz_set_ui(g1, 2*b-1);
-    mpz_mul_ui(g1, g1, 6*b-1);
-    mpz_mul_ui(g1, g1, 6*b-5);
-
-    mpz_set_ui(q1, b);
-    mpz_mul_ui(q1, q1, B);
-    mpz_add_ui(q1, q1, A);
-    mpz_mul   (q1, q1, g1);
-
-    if (b % 2)
-      mpz_neg(q1, q1);
-
-    i = b; while ((i & 1) == 0) i >>= 1;
-
-    fac_set_bp(fp1, i, 3);                  /* b^3 */
-    fac_mul_bp(fp1, 3*5*23*29, 3, ftmp, fmul);
-    fp1[0].pow[0]--;
-
-    fac_set_bp(fg1, 2*b-1, 1);              /* 2b-1 */
-    fac_mul_bp(fg1, 6*b-1, 1, ftmp, fmul);  /* 6b-1 */
-    fac_mul_bp(fg1, 6*b-5, 1, ftmp, fmul);  /* 6b-5 */
-
-  } else {
-    /*
-      p(a,b) = p(a,m) * p(m,b)
-      g(a,b) = g(a,m) * g(m,b)
-      q(a,b) = q(a,m) * p(m,b) + q(m,b) * g(a,m)
-    */
-    mid = a + (b-a) * 0.54;  /* tuning parameter */
-
-    bs(p1, q1, g1, fp1, fg1, a, mid, terms, level+1,
-      gcd, ftmp, fmul, tmp, j, 0);
-
-    bs(pj, qj, gj, fpj, fgj, mid, b, terms, level+1,
-      gcd, ftmp, fmul, tmp, j+1, 0);
-
-    if (level >= 4)          /* tuning parameter */
-      fac_remove_gcd(pj, fpj, g1, fg1, gcd, fmul);
-
-    mpz_mul(qj, qj, g1);
-    fac_mul(fp1, fpj, fmul);
-
-    if (b < terms) {
-      mpz_mul(g1, g1, gj);
-      fac_mul(fg1, fgj, fmul);
-    }
-    if (clear_flag) {
-      fac_clear(fpj), fac_clear(fgj), mpz_clear(gj);
-      tmp[j].cleared = 1;
-    }
-
-    mpz_mul(q1, q1, pj);
-    mpz_add(q1, q1, qj);
-
-    if (clear_flag) mpz_clear(qj);
-
-    mpz_mul(p1, p1, pj);
-
-    if (clear_flag) mpz_clear(pj);
-  }
-}
-
 #endif /* PGMP_CHUDNOVSKY_H */
 
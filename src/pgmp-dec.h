@@ -0,0 +1,616 @@
+#line 2 "../src/pgmp-dec.h"
+/* Experimental decimal arithmetic for the final step, base 10^19.
+
+ * See pgmp-chudnovsky.h for the list of authors and the license.
+
+ * Enabled with -DUSE_DECIMAL. After the binary final step, pgmp-chudnovsky.c
+ * runs the division, square root and multiply again in decimal limbs of
+ * 10^19 from the same numerator and denominator, and reports wallclock
+ * for both paths. The decimal result needs no radix conversion of the
+ * output. Instead, the numerator and denominator are converted once,
+ * truncated to the working precision by a common power of two.
+
+ * Multiplication uses a three-prime NTT (primes k*2^40+1 below 2^63, with
+ * Montgomery reduction) and Garner's CRT. The three transforms run in
+ * parallel when threads are available. Reciprocal and inverse square
+ * root use Newton's iteration with doubling precision.
+ */
+
+#ifndef PGMP_DEC_H
+#define PGMP_DEC_H
+
+#include "pgmp-chudnovsky.h"
+
+#define DEC_BASE    UINT64_C(10000000000000000000)   /* 10^19 */
+#define DEC_DIGITS  19
+#define DEC_MUL_THRESHOLD  48   /* basecase below this many limbs */
+
+typedef unsigned __int128 u128_t;
+
+typedef struct {
+  uint64_t *d;
+  int64_t  n;       /* d[n-1] != 0 unless n == 0 */
+  int64_t  e;       /* value = sum d[i] * 10^(19*(i+e)) */
+} dec_struct;
+
+typedef dec_struct dec_t[1];
+
+int dec_nthrs = 1;
+
+void dec_init (dec_t x)
+{
+  x->d = NULL, x->n = 0, x->e = 0;
+}
+
+void dec_clear (dec_t x)
+{
+  free(x->d);
+}
+
+void dec_normalize (dec_t x)
+{
+  while (x->n > 0 && x->d[x->n-1] == 0) x->n--;
+}
+
+/* replace the limbs of x, freeing the old ones */
+void dec_set_limbs (dec_t x, uint64_t *d, int64_t n, int64_t e)
+{
+  free(x->d);
+  x->d = d, x->n = n, x->e = e;
+  dec_normalize(x);
+}
+
+/* keep the most significant prec limbs */
+void dec_trunc (dec_t x, int64_t prec)
+{
+  if (x->n > prec) {
+    memmove(x->d, x->d + x->n - prec, prec * sizeof(uint64_t));
+    x->e += x->n - prec;
+    x->n = prec;
+  }
+}
+
+/* read-only view of the most significant prec limbs of x */
+void dec_view (dec_t v, dec_t x, int64_t prec)
+{
+  *v = *x;
+  if (v->n > prec) {
+    v->d += v->n - prec;
+    v->e += v->n - prec;
+    v->n = prec;
+  }
+}
+
+/* x = integer given by len decimal digits */
+void dec_set_str (dec_t x, const char *s, size_t len)
+{
+  int64_t n = (len + DEC_DIGITS - 1) / DEC_DIGITS, i;
+  uint64_t *d = malloc(max(n, 1) * sizeof(uint64_t));
+
+  for (i = 0; i < n; i++) {
+    size_t end = len - i * DEC_DIGITS;
+    size_t beg = (end > DEC_DIGITS) ? end - DEC_DIGITS : 0;
+    uint64_t v = 0;
+
+    for (; beg < end; beg++)
+      v = v * 10 + (s[beg] - '0');
+
+    d[i] = v;
+  }
+
+  dec_set_limbs(x, d, n, 0);
+}
+
+/* x = z / 2^shift, z > 0 */
+void dec_set_mpz_2exp (dec_t x, mpz_t z, uint64_t shift)
+{
+  mpz_t t;
+  char *s;
+
+  mpz_init(t);
+  mpz_tdiv_q_2exp(t, z, shift);
+
+  s = malloc(mpz_sizeinbase(t, 10) + 2);
+  mpz_get_str(s, 10, t);
+  dec_set_str(x, s, strlen(s));
+
+  free(s);
+  mpz_clear(t);
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+// Number theoretic transform modulo three primes, Montgomery form.
+
+typedef struct {
+  uint64_t p, g;
+  uint64_t pinv;    /* -p^-1 mod 2^64 */
+  uint64_t r2;      /* 2^128 mod p */
+} ntt_prime_t;
+
+ntt_prime_t ntt_primes[3] = {
+  { UINT64_C(9223369837831520257), 7, 0, 0 },
+  { UINT64_C(9223353345157103617), 5, 0, 0 },
+  { UINT64_C(9223346748087336961), 7, 0, 0 }
+};
+
+static inline uint64_t mont_mul (uint64_t a, uint64_t b, const ntt_prime_t *P)
+{
+  u128_t t = (u128_t) a * b;
+  uint64_t m = (uint64_t) t * P->pinv;
+  uint64_t u = (uint64_t) ((t + (u128_t) m * P->p) >> 64);
+  return (u >= P->p) ? u - P->p : u;
+}
+
+static inline uint64_t mod_add (uint64_t a, uint64_t b, uint64_t p)
+{
+  uint64_t s = a + b;
+  return (s >= p) ? s - p : s;
+}
+
+static inline uint64_t mod_sub (uint64_t a, uint64_t b, uint64_t p)
+{
+  return (a >= b) ? a - b : a + p - b;
+}
+
+uint64_t mod_pow (uint64_t a, uint64_t e, uint64_t p)
+{
+  uint64_t r = 1;
+
+  for (a %= p; e > 0; e >>= 1) {
+    if (e & 1) r = (uint64_t) ((u128_t) r * a % p);
+    a = (uint64_t) ((u128_t) a * a % p);
+  }
+
+  return r;
+}
+
+void ntt_init ()
+{
+  int i, j;
+
+  for (i = 0; i < 3; i++) {
+    ntt_prime_t *P = &ntt_primes[i];
+    uint64_t inv = P->p, r;
+
+    if (P->pinv) continue;
+
+    for (j = 0; j < 6; j++) inv *= 2 - P->p * inv;
+
+    r = (uint64_t) (((u128_t) 1 << 64) % P->p);
+    P->pinv = -inv;
+    P->r2 = (uint64_t) ((u128_t) r * r % P->p);
+  }
+}
+
+/* roots[j] = w^j for j < N/2 in Montgomery form, w^(+-1) of order N */
+void ntt_roots (uint64_t *roots, uint64_t N, int inverse, const ntt_prime_t *P)
+{
+  uint64_t w = mod_pow(P->g, (P->p - 1) / N, P->p), j;
+
+  if (inverse)
+    w = mod_pow(w, N - 1, P->p);
+
+  w = mont_mul(w, P->r2, P);
+  roots[0] = mont_mul(1, P->r2, P);
+
+  for (j = 1; j < N/2; j++)
+    roots[j] = mont_mul(roots[j-1], w, P);
+}
+
+/* decimation in frequency, output in bit-reversed order */
+void ntt_forward (uint64_t *a, uint64_t N, uint64_t *roots, const ntt_prime_t *P)
+{
+  uint64_t h, s, j, stride, u, v;
+
+  for (h = N/2, stride = 1; h >= 1; h /= 2, stride *= 2) {
+    for (s = 0; s < N; s += 2*h) {
+      for (j = 0; j < h; j++) {
+        u = a[s+j], v = a[s+j+h];
+        a[s+j]   = mod_add(u, v, P->p);
+        a[s+j+h] = mont_mul(mod_sub(u, v, P->p), roots[j*stride], P);
+      }
+    }
+  }
+}
+
+/* decimation in time, input in bit-reversed order */
+void ntt_inverse (uint64_t *a, uint64_t N, uint64_t *roots, const ntt_prime_t *P)
+{
+  uint64_t h, s, j, stride, u, v;
+
+  for (h = 1, stride = N/2; h < N; h *= 2, stride /= 2) {
+    for (s = 0; s < N; s += 2*h) {
+      for (j = 0; j < h; j++) {
+        u = a[s+j], v = mont_mul(a[s+j+h], roots[j*stride], P);
+        a[s+j]   = mod_add(u, v, P->p);
+        a[s+j+h] = mod_sub(u, v, P->p);
+      }
+    }
+  }
+}
+
+/* r[0..N) = a*b mod P, cyclic, plain (not Montgomery) form */
+void ntt_conv (uint64_t *r, uint64_t *a, int64_t na, uint64_t *b, int64_t nb, uint64_t N, const ntt_prime_t *P)
+{
+  uint64_t *fb = malloc(N * sizeof(uint64_t));
+  uint64_t *roots = malloc(N/2 * sizeof(uint64_t));
+  uint64_t ninv = mod_pow(N, P->p - 2, P->p), i;
+
+  for (i = 0; i < N; i++) {
+    r[i]  = (i < (uint64_t) na) ? mont_mul(a[i] % P->p, P->r2, P) : 0;
+    fb[i] = (i < (uint64_t) nb) ? mont_mul(b[i] % P->p, P->r2, P) : 0;
+  }
+
+  ntt_roots(roots, N, 0, P);
+  ntt_forward(r, N, roots, P);
+  ntt_forward(fb, N, roots, P);
+
+  for (i = 0; i < N; i++)
+    r[i] = mont_mul(r[i], fb[i], P);
+
+  ntt_roots(roots, N, 1, P);
+  ntt_inverse(r, N, roots, P);
+
+  /* leave Montgomery form and divide by N at once */
+  for (i = 0; i < N; i++)
+    r[i] = mont_mul(r[i], ninv, P);
+
+  free(roots);
+  free(fb);
+}
+
+/* rp[0..na+nb) = a*b, base 10^19 */
+void dec_mul_ntt (uint64_t *rp, uint64_t *a, int64_t na, uint64_t *b, int64_t nb)
+{
+  const ntt_prime_t *P1 = &ntt_primes[0], *P2 = &ntt_primes[1], *P3 = &ntt_primes[2];
+  uint64_t N = 1, *res[3], c12, c13, c23, p12_lo, p12_hi;
+  uint64_t k0 = 0, k1 = 0, k2 = 0;   /* carry, 192 bits */
+  int64_t  i;
+  int      j;
+
+  while (N < (uint64_t) (na + nb - 1)) N *= 2;
+
+  ntt_init();
+
+  for (j = 0; j < 3; j++)
+    res[j] = malloc(N * sizeof(uint64_t));
+
+ #if defined(_OPENMP)
+ #pragma omp parallel for num_threads(dec_nthrs)
+ #endif
+  for (j = 0; j < 3; j++)
+    ntt_conv(res[j], a, na, b, nb, N, &ntt_primes[j]);
+
+  /* Garner's constants in Montgomery form, so mont_mul(x, c) = x*c */
+  c12 = mont_mul(mod_pow(P1->p % P2->p, P2->p - 2, P2->p), P2->r2, P2);
+  c13 = mont_mul(mod_pow(P1->p % P3->p, P3->p - 2, P3->p), P3->r2, P3);
+  c23 = mont_mul(mod_pow(P2->p % P3->p, P3->p - 2, P3->p), P3->r2, P3);
+
+  {
+    u128_t t = (u128_t) P1->p * P2->p;
+    p12_lo = (uint64_t) t, p12_hi = (uint64_t) (t >> 64);
+  }
+
+  for (i = 0; i < na + nb; i++) {
+    uint64_t v1 = 0, v2 = 0, v3 = 0, x0, x1, x2, c;
+    u128_t t, u0, u1, u2;
+
+    if ((uint64_t) i < N) {
+      v1 = res[0][i];
+      v2 = mont_mul(mod_sub(res[1][i], v1 % P2->p, P2->p), c12, P2);
+      v3 = mont_mul(mod_sub(res[2][i], v1 % P3->p, P3->p), c13, P3);
+      v3 = mont_mul(mod_sub(v3, v2 % P3->p, P3->p), c23, P3);
+    }
+
+    /* x = v1 + v2*p1 + v3*p1*p2 + carry, in 64-bit words */
+    u0 = (u128_t) v2 * P1->p + v1;
+    u1 = (u128_t) v3 * p12_lo;
+    u2 = (u128_t) v3 * p12_hi;
+
+    t  = (u128_t) (uint64_t) u0 + (uint64_t) u1 + k0;
+    x0 = (uint64_t) t, c = (uint64_t) (t >> 64);
+    t  = (u0 >> 64) + (u1 >> 64) + (uint64_t) u2 + k1 + c;
+    x1 = (uint64_t) t, c = (uint64_t) (t >> 64);
+    x2 = (uint64_t) (u2 >> 64) + k2 + c;
+
+    /* limb = x mod 10^19, carry = x / 10^19 */
+    t  = x2;                   k2 = (uint64_t) (t / DEC_BASE);
+    t  = ((t % DEC_BASE) << 64) | x1; k1 = (uint64_t) (t / DEC_BASE);
+    t  = ((t % DEC_BASE) << 64) | x0; k0 = (uint64_t) (t / DEC_BASE);
+
+    rp[i] = (uint64_t) (t % DEC_BASE);
+  }
+
+  for (j = 0; j < 3; j++)
+    free(res[j]);
+}
+
+/* rp[0..na+nb) = a*b, base 10^19 */
+void dec_mul_basecase (uint64_t *rp, uint64_t *a, int64_t na, uint64_t *b, int64_t nb)
+{
+  int64_t i, j;
+
+  memset(rp, 0, (na + nb) * sizeof(uint64_t));
+
+  for (i = 0; i < na; i++) {
+    uint64_t c = 0;
+
+    for (j = 0; j < nb; j++) {
+      u128_t t = (u128_t) a[i] * b[j] + rp[i+j] + c;
+      rp[i+j] = (uint64_t) (t % DEC_BASE);
+      c = (uint64_t) (t / DEC_BASE);
+    }
+
+    rp[i+nb] = c;
+  }
+}
+
+/* r = a*b */
+void dec_mul (dec_t r, dec_t a, dec_t b)
+{
+  int64_t n = a->n + b->n;
+  uint64_t *rp;
+
+  if (a->n == 0 || b->n == 0) {
+    dec_set_limbs(r, NULL, 0, 0);
+    return;
+  }
+
+  rp = malloc(n * sizeof(uint64_t));
+
+  if (min(a->n, b->n) < DEC_MUL_THRESHOLD)
+    dec_mul_basecase(rp, a->d, a->n, b->d, b->n);
+  else
+    dec_mul_ntt(rp, a->d, a->n, b->d, b->n);
+
+  dec_set_limbs(r, rp, n, a->e + b->e);
+}
+
+/* r = a*k */
+void dec_mul_ui (dec_t r, dec_t a, uint64_t k)
+{
+  uint64_t *rp = malloc((a->n + 1) * sizeof(uint64_t)), c = 0;
+  int64_t i;
+
+  for (i = 0; i < a->n; i++) {
+    u128_t t = (u128_t) a->d[i] * k + c;
+    rp[i] = (uint64_t) (t % DEC_BASE);
+    c = (uint64_t) (t / DEC_BASE);
+  }
+
+  rp[a->n] = c;
+  dec_set_limbs(r, rp, a->n + 1, a->e);
+}
+
+/* r = a/k, keeping one more limb */
+void dec_div_ui (dec_t r, dec_t a, uint64_t k)
+{
+  uint64_t *rp = malloc((a->n + 1) * sizeof(uint64_t));
+  u128_t rem = 0;
+  int64_t i;
+
+  for (i = a->n - 1; i >= -1; i--) {
+    u128_t t = rem * DEC_BASE + ((i >= 0) ? a->d[i] : 0);
+    rp[i+1] = (uint64_t) (t / k);
+    rem = t % k;
+  }
+
+  dec_set_limbs(r, rp, a->n + 1, a->e - 1);
+}
+
+/* r = k - a, for integer k < 10^19 and 0 <= a < k with a->e <= 0 */
+void dec_ui_sub (dec_t r, uint64_t k, dec_t a)
+{
+  int64_t n = -a->e + 1, i;
+  uint64_t *rp = calloc(n, sizeof(uint64_t)), borrow = 0;
+
+  rp[n-1] = k;
+
+  for (i = 0; i < n; i++) {
+    uint64_t s = (i < a->n) ? a->d[i] : 0;
+    uint64_t v = rp[i];
+
+    s += borrow;
+    borrow = (v < s);
+    rp[i] = borrow ? v + (DEC_BASE - s) : v - s;
+  }
+
+  dec_set_limbs(r, rp, n, a->e);
+}
+
+/* x = y * 10^(19*e) as two limbs, for 0 < y <= 1 */
+void dec_set_ld (dec_t x, long double y, int64_t e)
+{
+  uint64_t *d = malloc(2 * sizeof(uint64_t));
+  long double h = y * (long double) DEC_BASE;
+
+  d[1] = (uint64_t) h;
+  d[0] = (uint64_t) ((h - d[1]) * (long double) DEC_BASE);
+
+  if (d[1] >= DEC_BASE)
+    d[1] = DEC_BASE - 1, d[0] = DEC_BASE - 1;
+
+  dec_set_limbs(x, d, 2, e - 2);
+}
+
+/* Newton precision schedule in digits, returns the number of steps */
+int dec_schedule (int64_t *steps, int64_t prec)
+{
+  int64_t d = prec * DEC_DIGITS;
+  int n = 0;
+
+  while (d > 16) {
+    steps[n++] = d;
+    d = d / 2 + 1;
+  }
+
+  return n;
+}
+
+/* x = 1/a to prec limbs, a > 0 */
+void dec_inv (dec_t x, dec_t a, int64_t prec)
+{
+  int64_t steps[64], k;
+  long double top;
+  dec_t av, t;
+  int i;
+
+  top = (long double) a->d[a->n-1];
+  if (a->n > 1)
+    top += (long double) a->d[a->n-2] / (long double) DEC_BASE;
+
+  dec_set_ld(x, 1.0L / top, -(a->n - 1 + a->e));
+  dec_init(t);
+
+  for (i = dec_schedule(steps, prec + 2) - 1; i >= 0; i--) {
+    k = steps[i] / DEC_DIGITS + 2;
+
+    /* x = x*(2 - a*x) */
+    dec_view(av, a, k+1);
+    dec_mul(t, av, x), dec_trunc(t, k+2);
+    dec_ui_sub(t, 2, t), dec_trunc(t, k+2);
+    dec_mul(x, x, t), dec_trunc(x, k+1);
+  }
+
+  dec_clear(t);
+}
+
+/* y = 1/sqrt(c) to prec limbs */
+void dec_invsqrt_ui (dec_t y, uint64_t c, int64_t prec)
+{
+  int64_t steps[64], k;
+  dec_t t;
+  int i;
+
+  dec_set_ld(y, 1.0L / sqrtl((long double) c), 0);
+  dec_init(t);
+
+  for (i = dec_schedule(steps, prec + 2) - 1; i >= 0; i--) {
+    k = steps[i] / DEC_DIGITS + 2;
+
+    /* y = y*(3 - c*y^2)/2 */
+    dec_mul(t, y, y), dec_trunc(t, k+2);
+    dec_mul_ui(t, t, c);
+    dec_ui_sub(t, 3, t), dec_trunc(t, k+2);
+    dec_mul(y, y, t), dec_trunc(y, k+2);
+    dec_div_ui(y, y, 2), dec_trunc(y, k+1);
+  }
+
+  dec_clear(t);
+}
+
+/* "I.DDD...D" with digits after the point, truncated; x < 10^19 */
+char *dec_get_str (dec_t x, uint64_t digits)
+{
+  uint64_t limbs = digits / DEC_DIGITS + 1, i, ipart;
+  int64_t  top = -x->e - 1;              /* index of first fraction limb */
+  char ibuf[24], *str, *p;
+  size_t ilen;
+
+  ipart = (top + 1 >= 0 && top + 1 < x->n) ? x->d[top+1] : 0;
+  snprintf(ibuf, sizeof(ibuf), "%llu", (unsigned long long) ipart);
+  ilen = strlen(ibuf);
+
+  str = malloc(ilen + 1 + limbs * DEC_DIGITS + 1);
+  memcpy(str, ibuf, ilen);
+  str[ilen] = '.';
+  p = str + ilen + 1;
+
+  for (i = 0; i < limbs; i++) {
+    int64_t j = top - (int64_t) i;
+    uint64_t v = (j >= 0 && j < x->n) ? x->d[j] : 0;
+    int k;
+
+    for (k = DEC_DIGITS - 1; k >= 0; k--, v /= 10)
+      p[i * DEC_DIGITS + k] = '0' + v % 10;
+  }
+
+  p[digits] = 0;
+
+  return str;
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+// Final step in decimal: mul/div already applied to num and den.
+//
+//   r = num/den * sqrt(root)
+
+char *dec_final (mpz_t num, mpz_t den, uint64_t root, uint64_t digits, double *conv_time, double *div_time, double *mul_time)
+{
+  int64_t  prec = (digits + 16) / DEC_DIGITS + 3;
+  uint64_t need = (uint64_t) ((digits + 16) * BITS_PER_DIGIT) + 192, bits, shift;
+  double   t;
+  dec_t    n, d, r, s, nv;
+  char     *str;
+
+  dec_init(n), dec_init(d), dec_init(r), dec_init(s);
+
+  /* convert, dropping a common power of two */
+  t = wall_clock();
+
+  bits  = min(mpz_sizeinbase(num, 2), mpz_sizeinbase(den, 2));
+  shift = (bits > need) ? bits - need : 0;
+
+  dec_set_mpz_2exp(n, num, shift);
+  dec_set_mpz_2exp(d, den, shift);
+
+  *conv_time = wall_clock() - t;
+
+  /* reciprocal and inverse square root */
+  t = wall_clock();
+
+  dec_inv(r, d, prec);
+  if (root > 1) {
+    dec_invsqrt_ui(s, root, prec);
+    dec_mul_ui(s, s, root);
+  }
+
+  *div_time = wall_clock() - t;
+
+  /* multiply */
+  t = wall_clock();
+
+  dec_view(nv, n, prec);
+  dec_mul(r, nv, r), dec_trunc(r, prec);
+  if (root > 1)
+    dec_mul(r, r, s), dec_trunc(r, prec);
+
+  str = dec_get_str(r, digits);
+
+  *mul_time = wall_clock() - t;
+
+  dec_clear(n), dec_clear(d), dec_clear(r), dec_clear(s);
+
+  return str;
+}
+
+/* run dec_final and report against the binary result str and time */
+void dec_compare (mpz_t num, mpz_t den, uint64_t root, uint64_t digits, const char *str, double bin_time)
+{
+  double conv_time, div_time, mul_time, dec_time;
+  char *dstr = dec_final(num, den, root, digits, &conv_time, &div_time, &mul_time);
+  size_t i;
+
+  dec_time = conv_time + div_time + mul_time;
+
+  fprintf(stderr,
+    "# decimal  conv = %.2fs  div/sqrt = %.2fs  mul+str = %.2fs  total = %.2fs\n"
+    "# binary   div/sqrt+mul+get_str = %.2fs  decimal/binary = %.2f\n",
+    conv_time, div_time, mul_time, dec_time,
+    bin_time, (bin_time > 0.0) ? dec_time / bin_time : 0.0);
+
+  for (i = 0; str[i] && str[i] == dstr[i]; i++) ;
+
+  if (str[i] == 0 && dstr[i] == 0)
+    fprintf(stderr, "# decimal  digits match\n\n");
+  else
+    fprintf(stderr, "# decimal  digits differ at offset %llu\n\n",
+      (unsigned long long) i);
+
+  fflush(stderr);
+  free(dstr);
+}
+
+#endif /* PGMP_DEC_H */
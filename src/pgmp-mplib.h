@@ -0,0 +1,214 @@
+#line 2 "../src/pgmp-mplib.h"
+/* Runtime dispatch of large multiplications between GMP and MPIR.
+
+ * See pgmp-chudnovsky.h for the list of authors and the license.
+
+ * Enabled with -DUSE_MPLIB (make pi-mplib). Both libraries export the same
+ * __gmpn_* names, so each is loaded with dlopen using RTLD_LOCAL, and
+ * RTLD_DEEPBIND where available, keeping its symbols to itself. Only
+ * mpn_mul and mpn_sqr are looked up. Operands and results stay in mpz_t
+ * of the linked library and are passed as raw limbs.
+
+ * mplib_init times both libraries on balanced products of 2^k limbs, up
+ * to the largest product of the run, and records the faster one per size
+ * class k = log2(an+bn). Products below
+ * MPLIB_MIN_CLASS, or with no library loaded, go to the linked mpz_mul.
+ */
+
+#ifndef PGMP_MPLIB_H
+#define PGMP_MPLIB_H
+
+#if defined(_WIN32)
+#error "USE_MPLIB requires dlopen"
+#endif
+
+#include <dlfcn.h>
+
+#ifndef MPLIB_GMP
+#define MPLIB_GMP   "libgmp.so.10"
+#endif
+#ifndef MPLIB_MPIR
+#define MPLIB_MPIR  "libmpir.so.23"
+#endif
+
+#define MPLIB_MIN_CLASS  6      /* 2^6 limbs */
+#define MPLIB_MAX_CLASS  48
+#define MPLIB_CAL_CLASS  22     /* largest class timed */
+#define MPLIB_CAL_TIME   0.25   /* stop timing once a product takes longer */
+
+typedef void (*mplib_mul_fn) (mp_ptr, mp_srcptr, mp_size_t, mp_srcptr, mp_size_t);
+typedef void (*mplib_sqr_fn) (mp_ptr, mp_srcptr, mp_size_t);
+
+typedef struct {
+  const char   *name, *path;
+  void         *handle;
+  const char   *version;
+  mplib_mul_fn mul;
+  mplib_sqr_fn sqr;
+} mplib_t;
+
+mplib_t mplib[2] = {
+  { "gmp",  MPLIB_GMP,  NULL, NULL, NULL, NULL },
+  { "mpir", MPLIB_MPIR, NULL, NULL, NULL, NULL }
+};
+
+/* index into mplib per size class, -1 for the linked library */
+int mplib_class[MPLIB_MAX_CLASS+1];
+
+int mplib_load (mplib_t *m)
+{
+  int flags = RTLD_NOW | RTLD_LOCAL;
+  const char **v;
+
+ #if defined(RTLD_DEEPBIND)
+  flags |= RTLD_DEEPBIND;
+ #endif
+
+  if ((m->handle = dlopen(m->path, flags)) == NULL)
+    return 0;
+
+  m->mul = (mplib_mul_fn) dlsym(m->handle, "__gmpn_mul");
+  m->sqr = (mplib_sqr_fn) dlsym(m->handle, "__gmpn_sqr");
+
+  if (m->mul == NULL || m->sqr == NULL) {
+    dlclose(m->handle), m->handle = NULL;
+    return 0;
+  }
+
+  if ((v = (const char **) dlsym(m->handle, "__mpir_version")) == NULL)
+    v = (const char **) dlsym(m->handle, "__gmp_version");
+
+  m->version = (v != NULL) ? *v : "?";
+
+  return 1;
+}
+
+/* best wallclock of a product of n x n limbs */
+double mplib_time (mplib_t *m, mp_ptr rp, mp_srcptr ap, mp_srcptr bp, mp_size_t n)
+{
+  double best = 1e30, t, begin = wall_clock();
+  int i;
+
+  for (i = 0; i < 64 && (i < 3 || wall_clock()-begin < 0.01); i++) {
+    t = wall_clock();
+    m->mul(rp, ap, n, bp, n);
+    t = wall_clock()-t;
+    if (t < best) best = t;
+  }
+
+  return best;
+}
+
+/* load both libraries and time products of up to 'limbs' limbs */
+void mplib_init (uint64_t limbs)
+{
+  mp_ptr ap, bp, rp;
+  mp_size_t n, i;
+  uint64_t x = 88172645463325252ULL;
+  double t[2];
+  int k, j, last = -1, loaded = 0, top;
+  char map[MPLIB_MAX_CLASS+2];
+
+  for (k = 0; k <= MPLIB_MAX_CLASS; k++)
+    mplib_class[k] = -1;
+
+  for (j = 0; j < 2; j++) {
+    if (mplib_load(&mplib[j]))
+      loaded++, last = j;
+
+    fprintf(stderr, "# mplib %-4s = %s\n", mplib[j].name,
+      mplib[j].handle ? mplib[j].version : "not loaded");
+  }
+
+  if (loaded < 2) {
+    /* nothing to choose from, use the loaded one or the linked one */
+    for (k = MPLIB_MIN_CLASS; k <= MPLIB_MAX_CLASS; k++)
+      mplib_class[k] = last;
+    return;
+  }
+
+  for (top = 0; limbs > 1 && top < MPLIB_CAL_CLASS; limbs >>= 1) top++;
+  top = max(top, MPLIB_MIN_CLASS);
+
+  n  = (mp_size_t) 1 << (top - 1);
+  ap = malloc(n * sizeof(mp_limb_t));
+  bp = malloc(n * sizeof(mp_limb_t));
+  rp = malloc(2 * n * sizeof(mp_limb_t));
+
+  for (i = 0; i < n; i++) {
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17, ap[i] = (mp_limb_t) x;
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17, bp[i] = (mp_limb_t) x;
+  }
+
+  for (k = MPLIB_MIN_CLASS; k <= top; k++) {
+    n = (mp_size_t) 1 << (k - 1);
+
+    for (j = 0; j < 2; j++)
+      t[j] = mplib_time(&mplib[j], rp, ap, bp, n);
+
+    mplib_class[k] = last = (t[1] < t[0]) ? 1 : 0;
+
+    if (t[last] > MPLIB_CAL_TIME)
+      break;
+  }
+
+  /* larger classes follow the largest one timed */
+  for (k = min(k, top) + 1; k <= MPLIB_MAX_CLASS; k++)
+    mplib_class[k] = last;
+
+  for (k = MPLIB_MIN_CLASS; k <= top; k++)
+    map[k - MPLIB_MIN_CLASS] = mplib[mplib_class[k]].name[0];
+
+  map[top - MPLIB_MIN_CLASS + 1] = 0;
+  fprintf(stderr, "# mplib mul = %s (2^%d..2^%d limbs)\n",
+    map, MPLIB_MIN_CLASS, top);
+
+  free(ap), free(bp), free(rp);
+}
+
+/* r = a*b, routed by size */
+void mplib_mul (mpz_t r, mpz_t a, mpz_t b)
+{
+  mp_size_t an = abs(a->_mp_size), bn = abs(b->_mp_size), rn;
+  mpz_srcptr x = a, y = b;
+  mplib_t *m;
+  mpz_t t;
+  int k;
+
+  for (k = 0, rn = an + bn; rn > 1 && k < MPLIB_MAX_CLASS; rn >>= 1) k++;
+
+  if (k < MPLIB_MIN_CLASS || mplib_class[k] < 0 || an == 0 || bn == 0) {
+    mpz_mul(r, a, b);
+    return;
+  }
+
+  m = &mplib[mplib_class[k]];
+
+  if (an < bn) {
+    x = b, y = a;
+    rn = an, an = bn, bn = rn;
+  }
+
+  /* write into r when it is large enough and no source, see bs_stack_mpz */
+  if (r != x && r != y && r->_mp_alloc >= an + bn)
+    t[0] = r[0];
+  else
+    mpz_init2(t, (mp_bitcnt_t) (an + bn) * GMP_NUMB_BITS);
+
+  if (x == y)
+    m->sqr(t->_mp_d, x->_mp_d, an);
+  else
+    m->mul(t->_mp_d, x->_mp_d, an, y->_mp_d, bn);
+
+  rn = an + bn; rn -= (t->_mp_d[rn-1] == 0);
+  t->_mp_size = ((a->_mp_size < 0) != (b->_mp_size < 0)) ? -rn : rn;
+
+  if (t->_mp_d == r->_mp_d) {
+    r->_mp_size = t->_mp_size;
+  } else {
+    mpz_swap(r, t);
+    mpz_clear(t);
+  }
+}
+
+#endif /* PGMP_MPLIB_H */
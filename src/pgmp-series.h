@@ -0,0 +1,352 @@
+#line 2 "../src/pgmp-series.h"
+/* Hypergeometric series for the binary splitting engine in pgmp-bs.h.
+
+ * See pgmp-chudnovsky.h for the list of authors and the license.
+
+ * A series is summed as
+
+     S = a(0) + sum_{k=1..terms} a(k) * prod_{j=1..k} g(j)/p(j)
+
+ * The term callback sets p = p(k), g = g(k), q = a(k)*g(k) and lists the
+ * factors of p and g as base^pow, used for removing common factors.
+ * Factors of two are dropped by the engine. Bases need not be prime, but
+ * those of term k must be below max(sieve_min, k*sieve_mul); bs waits at
+ * term k for the sieve to reach that bound, see sieve_wait.
+ * The sizes of p(k), g(k) and q(k)/g(k) must not decrease with k; bs
+ * sizes its operands from them, see series_bits.
+
+ * Binary splitting over [0,terms) yields P and Q with S = (a0*P+Q)/P.
+ * The constant is then
+
+     mul/div * sqrt(root) * P/(a0*P+Q)    if inverse
+     mul/div * sqrt(root) * (a0*P+Q)/P    otherwise
+
+ * where root = 1 means no square root.
+ */
+
+#ifndef PGMP_SERIES_H
+#define PGMP_SERIES_H
+
+#define TERM_FACS 8
+
+typedef struct {
+  int      num;
+  uint64_t base[TERM_FACS];
+  uint64_t pow[TERM_FACS];
+} term_fac_t;
+
+typedef struct {
+  const char *name;
+  void     (*term) (mpz_t p, mpz_t q, mpz_t g, term_fac_t *fp, term_fac_t *fg, uint64_t k);
+  uint64_t (*terms) (uint64_t digits);
+  double   digits_per_term;
+  uint64_t a0, mul, div, root;
+  int      inverse;
+  uint64_t sieve_min, sieve_mul;
+} series_t;
+
+#define TERM_FAC(f,i,b,e) ((f)->base[i] = (b), (f)->pow[i] = (e))
+
+// Chudnovsky's formula, the default.
+
+void chudnovsky_term (mpz_t p, mpz_t q, mpz_t g, term_fac_t *fp, term_fac_t *fg, uint64_t b)
+{
+  /*
+    g(b-1,b) = (6b-5)(2b-1)(6b-1)
+    p(b-1,b) = b^3 * C^3 / 24
+    q(b-1,b) = (-1)^b*g(b-1,b)*(A+Bb).
+  */
+  mpz_set_ui(p, b);
+  mpz_mul_ui(p, p, b);
+  mpz_mul_ui(p, p, b);
+  mpz_mul_ui(p, p, (C/24) * (C/24));
+  mpz_mul_ui(p, p, (C*24));
+
+  mpz_set_ui(g, 2*b-1);
+  mpz_mul_ui(g, g, 6*b-1);
+  mpz_mul_ui(g, g, 6*b-5);
+
+  mpz_set_ui(q, b);
+  mpz_mul_ui(q, q, B);
+  mpz_add_ui(q, q, A);
+  mpz_mul   (q, q, g);
+
+  if (b % 2)
+    mpz_neg(q, q);
+
+  fp->num = 3;                          /* C^3/24 = 2^15 * 3^2 * 3335^3 */
+  TERM_FAC(fp, 0, b, 3);
+  TERM_FAC(fp, 1, 5*23*29, 3);
+  TERM_FAC(fp, 2, 3, 2);
+
+  fg->num = 3;
+  TERM_FAC(fg, 0, 2*b-1, 1);
+  TERM_FAC(fg, 1, 6*b-1, 1);
+  TERM_FAC(fg, 2, 6*b-5, 1);
+}
+
+uint64_t chudnovsky_terms (uint64_t digits)
+{
+  return digits/DIGITS_PER_ITER;
+}
+
+series_t series_pi = {
+  "pi", chudnovsky_term, chudnovsky_terms, DIGITS_PER_ITER,
+  A, C/D, 1, C, 1, 3*5*23*29+1, 6
+};
+
+// Ramanujan's 1/pi = 2*sqrt(2)/9801 * sum (4k)!(1103+26390k)/(k!^4 396^4k)
+
+void ramanujan_term (mpz_t p, mpz_t q, mpz_t g, term_fac_t *fp, term_fac_t *fg, uint64_t k)
+{
+  /*
+    g(k) = 8(4k-1)(2k-1)(4k-3)
+    p(k) = k^3 * 396^4
+    q(k) = g(k)*(1103+26390k)
+  */
+  mpz_set_ui(p, k);
+  mpz_mul_ui(p, p, k);
+  mpz_mul_ui(p, p, k);
+  mpz_mul_ui(p, p, 396*396);
+  mpz_mul_ui(p, p, 396*396);
+
+  mpz_set_ui(g, 4*k-1);
+  mpz_mul_ui(g, g, 2*k-1);
+  mpz_mul_ui(g, g, 4*k-3);
+  mpz_mul_2exp(g, g, 3);
+
+  mpz_set_ui(q, k);
+  mpz_mul_ui(q, q, 26390);
+  mpz_add_ui(q, q, 1103);
+  mpz_mul   (q, q, g);
+
+  fp->num = 2;                          /* 396^4 = 2^8 * 99^4 */
+  TERM_FAC(fp, 0, k, 3);
+  TERM_FAC(fp, 1, 99, 4);
+
+  fg->num = 3;
+  TERM_FAC(fg, 0, 4*k-1, 1);
+  TERM_FAC(fg, 1, 2*k-1, 1);
+  TERM_FAC(fg, 2, 4*k-3, 1);
+}
+
+series_t series_ramanujan = {
+  "ramanujan", ramanujan_term, NULL, 7.98254260135474904571, // log(396^4/256)/log(10)
+  1103, 9801, 4, 2, 1, 100, 4
+};
+
+// e = sum 1/k!
+
+void e_term (mpz_t p, mpz_t q, mpz_t g, term_fac_t *fp, term_fac_t *fg, uint64_t k)
+{
+  mpz_set_ui(p, k);
+  mpz_set_ui(g, 1);
+  mpz_set_ui(q, 1);
+
+  fp->num = 1;
+  TERM_FAC(fp, 0, k, 1);
+
+  fg->num = 0;
+}
+
+/* smallest k with (k+1)! > 10^(digits+16) */
+uint64_t e_terms (uint64_t digits)
+{
+  double target = (digits + 16) * log(10.0);
+  uint64_t lo = 1, hi = 2;
+
+  while (lgamma((double) hi + 2.0) < target) hi *= 2;
+
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (lgamma((double) mid + 2.0) < target)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+series_t series_e = {
+  "e", e_term, e_terms, 0.0,
+  1, 1, 1, 1, 0, 16, 2
+};
+
+// log(2) = 3/4 * sum (-1)^k k!^2 / (2^k (2k+1)!)
+
+void log2_term (mpz_t p, mpz_t q, mpz_t g, term_fac_t *fp, term_fac_t *fg, uint64_t k)
+{
+  mpz_set_ui(p, 2*k+1);
+  mpz_mul_2exp(p, p, 2);
+  mpz_set_ui(g, k);
+  mpz_set_ui(q, k);
+
+  if (k % 2)
+    mpz_neg(q, q);
+
+  fp->num = 1;
+  TERM_FAC(fp, 0, 2*k+1, 1);
+
+  fg->num = 1;
+  TERM_FAC(fg, 0, k, 1);
+}
+
+series_t series_log2 = {
+  "log2", log2_term, NULL, 0.90308998699194353856, // log(8)/log(10)
+  1, 3, 4, 1, 0, 16, 3
+};
+
+// zeta(3) = 1/64 * sum (-1)^k k!^10 (205k^2+250k+77) / (2k+1)!^5
+
+void zeta3_term (mpz_t p, mpz_t q, mpz_t g, term_fac_t *fp, term_fac_t *fg, uint64_t k)
+{
+  mpz_set_ui(p, 2*k+1);
+  mpz_pow_ui(p, p, 5);
+  mpz_mul_2exp(p, p, 5);
+
+  mpz_set_ui(g, k);
+  mpz_pow_ui(g, g, 5);
+
+  mpz_set_ui(q, 205*k+250);
+  mpz_mul_ui(q, q, k);
+  mpz_add_ui(q, q, 77);
+  mpz_mul   (q, q, g);
+
+  if (k % 2)
+    mpz_neg(q, q);
+
+  fp->num = 1;
+  TERM_FAC(fp, 0, 2*k+1, 5);
+
+  fg->num = 1;
+  TERM_FAC(fg, 0, k, 5);
+}
+
+series_t series_zeta3 = {
+  "zeta3", zeta3_term, NULL, 3.01029995663981195213, // log(1024)/log(10)
+  77, 1, 64, 1, 0, 16, 3
+};
+
+// Catalan's constant = 1/2 * sum (-8)^k (3k+2) / ((2k+1)^3 binomial(2k,k)^3)
+
+void catalan_term (mpz_t p, mpz_t q, mpz_t g, term_fac_t *fp, term_fac_t *fg, uint64_t k)
+{
+  mpz_set_ui(p, 2*k+1);
+  mpz_pow_ui(p, p, 3);
+
+  mpz_set_ui(g, k);
+  mpz_pow_ui(g, g, 3);
+
+  mpz_set_ui(q, 3*k+2);
+  mpz_mul   (q, q, g);
+
+  if (k % 2)
+    mpz_neg(q, q);
+
+  fp->num = 1;
+  TERM_FAC(fp, 0, 2*k+1, 3);
+
+  fg->num = 1;
+  TERM_FAC(fg, 0, k, 3);
+}
+
+series_t series_catalan = {
+  "catalan", catalan_term, NULL, 0.90308998699194353856, // log(8)/log(10)
+  2, 1, 2, 1, 0, 16, 3
+};
+
+series_t *series_list[] = {
+  &series_pi, &series_ramanujan, &series_e, &series_log2, &series_zeta3,
+  &series_catalan, NULL
+};
+
+series_t *series = &series_pi;
+
+series_t *series_find (const char *name)
+{
+  int i;
+
+  for (i = 0; series_list[i] != NULL; i++)
+    if (strcmp(series_list[i]->name, name) == 0)
+      return series_list[i];
+
+  return NULL;
+}
+
+/* number of terms, with 16 guard digits unless the series says otherwise */
+uint64_t series_terms (uint64_t digits)
+{
+  if (series->terms != NULL)
+    return series->terms(digits);
+
+  return (uint64_t) ((digits + 16) / series->digits_per_term) + 1;
+}
+
+/*
+  Bits of p(k), g(k), and q(k)/g(k) at k = 2^i, each the most up to 2^i,
+  bounds for all terms k <= 2^i. Filled up to the number of terms by
+  series_bits_init, see bs_size.
+*/
+uint64_t series_bits[64][3];
+
+void series_bits_init (uint64_t terms)
+{
+  term_fac_t fp, fg;
+  mpz_t p, q, g;
+  int64_t ba;
+  int i, c;
+
+  mpz_init(p), mpz_init(q), mpz_init(g);
+
+  for (i = 0; i < 64; i++) {
+    series->term(p, q, g, &fp, &fg, UINT64_C(1) << i);
+
+    ba = (int64_t) mpz_sizeinbase(q, 2) - (int64_t) mpz_sizeinbase(g, 2) + 1;
+    series_bits[i][0] = mpz_sizeinbase(p, 2);
+    series_bits[i][1] = mpz_sizeinbase(g, 2);
+    series_bits[i][2] = (ba > 1) ? (uint64_t) ba : 1;
+
+    for (c = 0; c < 3 && i > 0; c++)
+      series_bits[i][c] = max(series_bits[i][c], series_bits[i-1][c]);
+
+    if ((UINT64_C(1) << i) >= terms)
+      break;
+  }
+
+  mpz_clear(p), mpz_clear(q), mpz_clear(g);
+}
+
+/* log10 of p(k) */
+double series_log10_p (series_t *s, uint64_t k)
+{
+  term_fac_t fp, fg;
+  mpz_t p, q, g;
+  double d;
+  long   e;
+
+  mpz_init(p), mpz_init(q), mpz_init(g);
+  s->term(p, q, g, &fp, &fg, max(k, 1));
+  d = mpz_get_d_2exp(&e, p);
+  mpz_clear(p), mpz_clear(q), mpz_clear(g);
+
+  return (log(d) / log(2.0) + e) * 0.30102999566398119521;
+}
+
+/*
+  Digits of pi with a root P of about the same size as for the selected
+  series, for comparing against limits expressed in digits of pi.
+*/
+uint64_t series_pi_digits (uint64_t digits, uint64_t terms)
+{
+  uint64_t pi_terms = chudnovsky_terms(digits);
+
+  if (series == &series_pi || terms == 0 || pi_terms == 0)
+    return digits;
+
+  return (uint64_t) (digits *
+    (terms * series_log10_p(series, terms)) /
+    (pi_terms * series_log10_p(&series_pi, pi_terms)));
+}
+
+#endif /* PGMP_SERIES_H */
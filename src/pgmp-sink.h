@@ -0,0 +1,352 @@
+#line 2 "../src/pgmp-sink.h"
+/* Output sinks fed from one conversion, pi-gmp.exe --sink <spec> [ ... ].
+
+ * See pgmp-chudnovsky.h for the list of authors and the license.
+
+ * Each sink runs on its own OpenMP thread over the digit string, read in
+ * blocks of SINK_BLOCK chars shared by all of them; without OpenMP they
+ * run one after the other. The <option> output to stdout is one more
+ * sink. Specs, "-" for stdout:
+
+ *   raw:<file>        digits as option 1
+ *   cols:<N>:<file>   digits in N columns as option N
+ *   md5               MD5 of the raw digits, as md5sum of option 1
+ *   stats             count of each digit after the point, chi-square
+ *   packed:<file>     all digits as BCD, 2 per byte, high nibble first,
+ *                     an odd count ends with nibble 0xf
+
+ * Raw digits go out through output_raw, which hands the pages of the
+ * string to a pipe with vmsplice on Linux instead of copying them.
+ */
+
+#ifndef PGMP_SINK_H
+#define PGMP_SINK_H
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#define SINK_BLOCK  (1 << 20)
+#define SINK_MAX    16
+#define SINK_PIPE   (1 << 20)   /* pipe size asked for, and bytes per vmsplice */
+
+enum { SINK_RAW, SINK_COLS, SINK_MD5, SINK_STATS, SINK_PACKED };
+
+typedef struct {
+  int           kind, columns, spliced;
+  const char    *path;
+  FILE          *fp;
+  double        time;
+  uint32_t      md5[4];
+  uint64_t      count[10];
+} sink_t;
+
+sink_t sinks[SINK_MAX];
+int    nsinks = 0;
+
+////////////////////////////////////////////////////////////////////////////
+// MD5, RFC 1321
+
+static const uint32_t md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+  0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+  0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+  0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+  0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+  0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned char md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+void md5_block (uint32_t h[4], const unsigned char *p)
+{
+  uint32_t w[16], a = h[0], b = h[1], c = h[2], d = h[3], f, t;
+  int i, g;
+
+  for (i = 0; i < 16; i++)
+    w[i] = (uint32_t) p[i*4] | (uint32_t) p[i*4+1] << 8 |
+           (uint32_t) p[i*4+2] << 16 | (uint32_t) p[i*4+3] << 24;
+
+  for (i = 0; i < 64; i++) {
+    if (i < 16)      f = (b & c) | (~b & d), g = i;
+    else if (i < 32) f = (d & b) | (~d & c), g = (5*i + 1) & 15;
+    else if (i < 48) f = b ^ c ^ d,          g = (3*i + 5) & 15;
+    else             f = c ^ (b | ~d),       g = (7*i) & 15;
+
+    t = d, d = c, c = b;
+    f += a + md5_k[i] + w[g];
+    b += (f << md5_r[i]) | (f >> (32 - md5_r[i]));
+    a = t;
+  }
+
+  h[0] += a, h[1] += b, h[2] += c, h[3] += d;
+}
+
+/* MD5 of the n chars at p */
+void md5 (uint32_t h[4], const char *p, uint64_t n)
+{
+  unsigned char tail[128];
+  uint64_t i, bits = n * 8;
+  int m;
+
+  h[0] = 0x67452301, h[1] = 0xefcdab89, h[2] = 0x98badcfe, h[3] = 0x10325476;
+
+  for (i = 0; i + 64 <= n; i += 64)
+    md5_block(h, (const unsigned char *) p + i);
+
+  m = (int) (n - i);
+  memcpy(tail, p + i, m);
+  tail[m++] = 0x80;
+
+  while (m % 64 != 56)
+    tail[m++] = 0;
+
+  for (i = 0; i < 8; i++)
+    tail[m++] = (unsigned char) (bits >> (8*i));
+
+  for (i = 0; i < (uint64_t) m; i += 64)
+    md5_block(h, tail + i);
+}
+
+////////////////////////////////////////////////////////////////////////////
+
+/* write len chars to fp, bypassing its buffer. A pipe on Linux gets the
+   pages with vmsplice; the reader may see them after the return, so str
+   must then stay untouched and not be freed. Returns 1 in that case, 0
+   after write, and -1 on an error */
+int output_raw (FILE *fp, const char *str, uint64_t len)
+{
+  int fd = fileno(fp), spliced = 0;
+  ssize_t n;
+
+  fflush(fp);
+
+ #if defined(__linux__)
+  {
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+      /* fewer, larger splices; limited by /proc/sys/fs/pipe-max-size */
+      fcntl(fd, F_SETPIPE_SZ, SINK_PIPE);
+
+      while (len > 0) {
+        struct iovec iov;
+
+        iov.iov_base = (void *) str;
+        iov.iov_len  = min(len, (uint64_t) SINK_PIPE);
+
+        if ((n = vmsplice(fd, &iov, 1, 0)) < 0) {
+          if (errno == EINTR) continue;
+          if (!spliced) break;     /* not supported, write below */
+          return -1;
+        }
+        str += n, len -= n, spliced = 1;
+      }
+
+      if (len == 0)
+        return 1;
+    }
+  }
+ #endif
+
+  while (len > 0) {
+    if ((n = write(fd, str, min(len, (uint64_t) 1 << 30))) < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    str += n, len -= n;
+  }
+
+  return spliced;
+}
+
+/* add a sink from its spec, exits on a bad one */
+void sink_add (const char *spec)
+{
+  sink_t *s = &sinks[nsinks];
+  const char *arg = strchr(spec, ':');
+  size_t len = arg ? (size_t) (arg - spec) : strlen(spec);
+
+  if (nsinks == SINK_MAX) {
+    fprintf(stderr,"Too many sinks, at most %d\n", SINK_MAX);
+    exit(1);
+  }
+
+  memset(s, 0, sizeof(sink_t));
+
+  if (len == 3 && strncmp(spec, "raw", 3) == 0 && arg)
+    s->kind = SINK_RAW, s->path = arg+1;
+  else if (len == 4 && strncmp(spec, "cols", 4) == 0 && arg && strchr(arg+1, ':'))
+    s->kind = SINK_COLS, s->columns = atoi(arg+1), s->path = strchr(arg+1, ':')+1;
+  else if (len == 6 && strncmp(spec, "packed", 6) == 0 && arg)
+    s->kind = SINK_PACKED, s->path = arg+1;
+  else if (strcmp(spec, "md5") == 0)
+    s->kind = SINK_MD5;
+  else if (strcmp(spec, "stats") == 0)
+    s->kind = SINK_STATS;
+  else {
+    fprintf(stderr,"Unknown sink %s\n", spec);
+    exit(1);
+  }
+
+  if (s->kind == SINK_COLS && (s->columns < 1 || s->columns > 14)) {
+    fprintf(stderr,"Sink %s needs 1 to 14 columns\n", spec);
+    exit(1);
+  }
+
+  /* open now, before spending the run */
+  if (s->path != NULL) {
+    int i;
+
+    for (i = 0; i < nsinks && strcmp(s->path, "-") == 0; i++) {
+      if (sinks[i].fp == stdout) {
+        fprintf(stderr,"Only one sink may write to stdout\n");
+        exit(1);
+      }
+    }
+
+    s->fp = (strcmp(s->path, "-") == 0) ? stdout : fopen(s->path, "wb");
+    if (s->fp == NULL) {
+      fprintf(stderr,"Cannot open %s\n", s->path);
+      exit(1);
+    }
+  }
+
+  nsinks++;
+}
+
+void sink_run (sink_t *s, char *str, uint64_t len, uint64_t digits)
+{
+  unsigned char *pk = NULL;
+  uint64_t i, j, n = 0, dot = strchr(str, '.') - str;
+  int half = 0;
+
+  if (s->kind == SINK_COLS) {
+    output_digits_fp(s->fp, str, digits, s->columns);
+    return;
+  }
+  if (s->kind == SINK_MD5) {
+    md5(s->md5, str, len);
+    return;
+  }
+  if (s->kind == SINK_RAW) {
+    s->spliced = output_raw(s->fp, str, len);
+    return;
+  }
+  if (s->kind == SINK_PACKED)
+    pk = malloc(SINK_BLOCK/2 + 1);
+
+  for (i = 0; i < len; i += SINK_BLOCK) {
+    uint64_t end = min(i + SINK_BLOCK, len);
+
+    switch (s->kind) {
+    case SINK_STATS:
+      for (j = max(i, dot + 1); j < end; j++)
+        s->count[str[j] - '0']++;
+      break;
+    case SINK_PACKED:
+      /* a nibble left over from the last block starts this one */
+      for (j = i, n = 0; j < end; j++) {
+        if (str[j] == '.') continue;
+        if (half)
+          pk[n++] |= str[j] - '0', half = 0;
+        else
+          pk[n] = (str[j] - '0') << 4, half = 1;
+      }
+      fwrite(pk, 1, n, s->fp);
+      if (half) pk[0] = pk[n];
+      break;
+    }
+  }
+
+  if (s->kind == SINK_PACKED) {
+    if (half)
+      pk[0] |= 0xf, fwrite(pk, 1, 1, s->fp);
+    free(pk);
+  }
+
+  if (s->fp != NULL)
+    fflush(s->fp);
+}
+
+/* feed str, digits after the point, to all sinks and report them;
+   returns 1 when str was spliced to a pipe, see output_raw */
+int sinks_run (char *str, uint64_t digits)
+{
+  uint64_t len = strlen(str);
+  int i, spliced = 0;
+
+  commify(0);  /* sets the separator before the threads */
+
+ #if defined(_OPENMP)
+ #pragma omp parallel for schedule(dynamic,1) num_threads(nsinks)
+ #endif
+  for (i = 0; i < nsinks; i++) {
+    double t = wall_clock();
+    sink_run(&sinks[i], str, len, digits);
+    sinks[i].time = wall_clock()-t;
+  }
+
+  /* as option 1, end the digits on a terminal */
+  for (i = 0; i < nsinks; i++) {
+    if (sinks[i].fp == stdout)
+      fprintf(stderr, "\n");
+  }
+
+  for (i = 0; i < nsinks; i++) {
+    sink_t *s = &sinks[i];
+
+    if (s->fp != NULL && s->fp != stdout)
+      fclose(s->fp);
+
+    if (s->kind == SINK_MD5) {
+      int k;
+
+      fprintf(stderr,"# sink md5 = ");
+      for (k = 0; k < 16; k++)
+        fprintf(stderr,"%02x", (unsigned) (s->md5[k/4] >> (8*(k%4))) & 0xff);
+      fprintf(stderr,"  (%.2fs)\n", s->time);
+    }
+    else if (s->kind == SINK_STATS) {
+      double chi = 0.0, e = digits / 10.0;
+      int k;
+
+      fprintf(stderr,"# sink stats =");
+      for (k = 0; k < 10; k++) {
+        fprintf(stderr," %llu", (unsigned long long) s->count[k]);
+        chi += (s->count[k] - e) * (s->count[k] - e) / (e > 0.0 ? e : 1.0);
+      }
+      fprintf(stderr,", chi-square = %.2f  (%.2fs)\n", chi, s->time);
+    }
+    else if (s->kind == SINK_RAW) {
+      fprintf(stderr,"# sink raw = %s  (%.2fs, %.0f MB/s, %s)\n",
+        s->path, s->time, len / max(s->time, 1e-6) / 1e6,
+        s->spliced > 0 ? "vmsplice" : s->spliced < 0 ? "failed" : "write");
+      spliced |= (s->spliced > 0);
+    }
+    else {
+      fprintf(stderr,"# sink %s = %s  (%.2fs)\n",
+        s->kind == SINK_COLS ? "cols" : "packed", s->path, s->time);
+    }
+  }
+
+  fflush(stderr);
+
+  return spliced;
+}
+
+#endif /* PGMP_SINK_H */
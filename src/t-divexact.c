@@ -0,0 +1,102 @@
+/* Randomized check of divexact and divexact2 against mpz_divexact.
+
+   Build and run with "make check", or by hand, e.g.
+     gcc -std=gnu99 -O2 -fopenmp -DUSE_GMP t-divexact.c -o t-divexact -lgmp -lm
+
+   The quotients reach DIVEXACT_SPLIT limbs, and the calls are made from
+   a team of two threads, so that divexact takes its split into a high
+   part by truncating division and a low part by Hensel division for odd
+   divisors. Even divisors and smaller quotients take mpz_divexact.  */
+
+#include "pgmp-chudnovsky.h"
+
+#define REPS 6
+
+static int fails = 0;
+
+static void fail (const char *what, size_t qn, size_t dn, int i)
+{
+  fprintf(stderr, "t-divexact: %s, %lu by %lu limbs, test %d\n",
+    what, (unsigned long) qn, (unsigned long) dn, i);
+  fails++;
+}
+
+/* n = q*d with a quotient of qn limbs and a divisor of dn limbs */
+static void check (gmp_randstate_t rs, size_t qn, size_t dn, int i)
+{
+  mpz_t d, n, g, q, r, s;
+
+  mpz_init(d), mpz_init(n), mpz_init(g);
+  mpz_init(q), mpz_init(r), mpz_init(s);
+
+  mpz_urandomb(q, rs, qn * GMP_NUMB_BITS);
+  mpz_setbit(q, qn * GMP_NUMB_BITS - 1);
+  mpz_rrandomb(d, rs, dn * GMP_NUMB_BITS);
+  if (i & 1)
+    mpz_setbit(d, 0);
+  else
+    mpz_clrbit(d, 0);                   /* even, left to mpz_divexact */
+
+  mpz_mul(n, q, d);
+  mpz_divexact(r, n, d);
+
+  divexact(s, n, d);
+  if (mpz_cmp(s, r) != 0)
+    fail("divexact", qn, dn, i);
+
+  /* divexact2 on n and on a multiple of d of another size */
+  mpz_urandomb(g, rs, (qn / 2 + 1) * GMP_NUMB_BITS);
+  mpz_mul(g, g, d);
+  mpz_divexact(s, g, d);
+  mpz_set(q, n);
+
+  divexact2(q, g, d);
+  if (mpz_cmp(q, r) != 0 || mpz_cmp(g, s) != 0)
+    fail("divexact2", qn, dn, i);
+
+  mpz_clear(d), mpz_clear(n), mpz_clear(g);
+  mpz_clear(q), mpz_clear(r), mpz_clear(s);
+}
+
+int main (int argc, char *argv[])
+{
+  gmp_randstate_t rs;
+  unsigned long seed = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1;
+  int i;
+
+  gmp_randinit_default(rs);
+  gmp_randseed_ui(rs, seed);
+
+ #if defined(_OPENMP)
+  omp_set_dynamic(0);
+  #pragma omp parallel num_threads(2)
+  #pragma omp single
+ #endif
+  {
+   #if defined(_OPENMP)
+    if (omp_get_num_threads() < 2)
+      fail("team of one thread", 0, 0, -1);
+   #endif
+
+    for (i = 0; i < REPS; i++) {
+      size_t qn = DIVEXACT_SPLIT + gmp_urandomm_ui(rs, DIVEXACT_SPLIT / 2);
+      size_t dn = (i < 2) ? 1 + gmp_urandomm_ui(rs, 4)
+                          : 1 + gmp_urandomm_ui(rs, DIVEXACT_SPLIT / 4);
+      check(rs, qn, dn, i);
+    }
+
+    check(rs, DIVEXACT_SPLIT - 2, 1000, REPS + 1);
+    check(rs, DIVEXACT_TASK, 10, REPS + 3);
+  }
+
+  gmp_randclear(rs);
+
+  if (fails) {
+    fprintf(stderr, "t-divexact: %d of %d failed, seed %lu\n",
+      fails, 2 * (REPS + 2), seed);
+    return 1;
+  }
+
+  printf("t-divexact: %d passed, seed %lu\n", 2 * (REPS + 2), seed);
+  return 0;
+}